@@ -0,0 +1,250 @@
+#ifndef TFNET_BUILD_METRICS_HPP
+#define TFNET_BUILD_METRICS_HPP
+
+#include <boost/thread.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+// Counts a build's progress as it goes, and reports it every so often from
+// a thread of its own: a line to stderr, and, if asked for, a Prometheus
+// text format file, rewritten by renaming a new copy over it so a scraper
+// never reads half of one. The workers add to the counts once a contig,
+// under a mutex; the TFBS counts are those of the first network.
+class BuildMetrics
+{
+public:
+  BuildMetrics()
+    : mStart(now()), mStopping(false), mRunning(false)
+  {
+  }
+
+  ~BuildMetrics()
+  {
+    stop();
+  }
+
+  // Starts reporting every aInterval seconds, to aPath as well as stderr
+  // unless aPath is empty.
+  void
+  start(double aInterval, const std::string& aPath)
+  {
+    mInterval = aInterval;
+    mPath = aPath;
+    mLast = mCounts;
+    mLastTime = now();
+    mRunning = true;
+    mReporter = boost::thread(boost::bind(&BuildMetrics::run, this));
+  }
+
+  // Stops the reporter, after one last report.
+  void
+  stop()
+  {
+    if (!mRunning)
+      return;
+    {
+      boost::mutex::scoped_lock lock(mMutex);
+      mStopping = true;
+      mWake.notify_all();
+    }
+    mReporter.join();
+    mRunning = false;
+  }
+
+  void
+  addChromosomes(uint32_t aChromosomes, uint64_t aContigs)
+  {
+    boost::mutex::scoped_lock lock(mMutex);
+    mCounts.chromosomes += aChromosomes;
+    mCounts.contigs += aContigs;
+  }
+
+  // aOverlaps are the gene-TFBS region overlaps found, which are not
+  // distinct edges: an edge is found again at each site that gives it.
+  void
+  contigDone(uint64_t aTFBSs, uint64_t aOverlaps, uint64_t aBytes)
+  {
+    boost::mutex::scoped_lock lock(mMutex);
+    mCounts.contigsDone++;
+    mCounts.tfbsProcessed += aTFBSs;
+    mCounts.overlaps += aOverlaps;
+    mCounts.bytesRead += aBytes;
+  }
+
+  // aSkippedContigs are BaSeTraM files of the chromosome that no contig
+  // with genes came to, and so are done with too.
+  void
+  chromosomeDone(uint64_t aSkippedContigs, uint64_t aBytes)
+  {
+    boost::mutex::scoped_lock lock(mMutex);
+    mCounts.chromosomesDone++;
+    mCounts.contigsDone += aSkippedContigs;
+    mCounts.bytesRead += aBytes;
+  }
+
+  // The TFBSs found to be used or not, so far as the chromosomes have been
+  // merged.
+  void
+  merged(uint64_t aUsed, uint64_t aUnused)
+  {
+    boost::mutex::scoped_lock lock(mMutex);
+    mCounts.tfbsUsed = aUsed;
+    mCounts.tfbsUnused = aUnused;
+  }
+
+private:
+  struct Counts
+  {
+    Counts()
+      : chromosomes(0), chromosomesDone(0), contigs(0), contigsDone(0),
+        tfbsProcessed(0), overlaps(0), tfbsUsed(0), tfbsUnused(0),
+        bytesRead(0)
+    {
+    }
+
+    uint64_t chromosomes, chromosomesDone, contigs, contigsDone;
+    uint64_t tfbsProcessed, overlaps, tfbsUsed, tfbsUnused, bytesRead;
+  };
+
+  static double
+  now()
+  {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1E-9;
+  }
+
+  // The resident set size, from /proc, or 0 where there is no /proc.
+  static uint64_t
+  residentBytes()
+  {
+    std::ifstream statm("/proc/self/statm");
+    uint64_t size, resident;
+    if (!(statm >> size >> resident))
+      return 0;
+    return resident * sysconf(_SC_PAGESIZE);
+  }
+
+  void
+  run()
+  {
+    boost::mutex::scoped_lock lock(mMutex);
+    while (true)
+    {
+      boost::system_time deadline = boost::get_system_time() +
+        boost::posix_time::milliseconds(static_cast<int64_t>(mInterval * 1000));
+      while (!mStopping && mWake.timed_wait(lock, deadline))
+        ;
+
+      Counts counts(mCounts);
+      bool stopping = mStopping;
+      lock.unlock();
+      report(counts);
+      lock.lock();
+      if (stopping)
+        return;
+    }
+  }
+
+  void
+  report(const Counts& aCounts)
+  {
+    double time = now(), elapsed = time - mLastTime;
+    double tfbsRate = elapsed > 0 ?
+      (aCounts.tfbsProcessed - mLast.tfbsProcessed) / elapsed : 0.0;
+    double byteRate = elapsed > 0 ?
+      (aCounts.bytesRead - mLast.bytesRead) / elapsed : 0.0;
+    uint64_t remaining = aCounts.contigs > aCounts.contigsDone ?
+      aCounts.contigs - aCounts.contigsDone : 0;
+    uint64_t resident = residentBytes();
+    mLast = aCounts;
+    mLastTime = time;
+
+    std::cerr << "Progress: " << aCounts.chromosomesDone << "/"
+              << aCounts.chromosomes << " chromosomes, "
+              << aCounts.contigsDone << " contigs done, " << remaining
+              << " remaining, " << aCounts.tfbsProcessed << " TFBSs ("
+              << static_cast<uint64_t>(tfbsRate) << "/s), "
+              << (aCounts.bytesRead >> 20) << " MB read ("
+              << (byteRate / (1 << 20)) << " MB/s), " << aCounts.overlaps
+              << " gene-TFBS overlaps, RSS " << (resident >> 20) << " MB"
+              << std::endl;
+
+    if (mPath == "")
+      return;
+
+    std::ostringstream text;
+    metric(text, "tfnet_elapsed_seconds", "gauge",
+           "Seconds since the build started.", time - mStart);
+    metric(text, "tfnet_chromosomes", "gauge",
+           "Chromosomes to process.", aCounts.chromosomes);
+    metric(text, "tfnet_chromosomes_done", "gauge",
+           "Chromosomes processed.", aCounts.chromosomesDone);
+    metric(text, "tfnet_contigs_done", "gauge",
+           "Contigs processed.", aCounts.contigsDone);
+    metric(text, "tfnet_contigs_remaining", "gauge",
+           "Contigs, by BaSeTraM file, still to process.", remaining);
+    metric(text, "tfnet_tfbs_processed_total", "counter",
+           "TFBSs read from the BaSeTraM output.", aCounts.tfbsProcessed);
+    metric(text, "tfnet_tfbs_per_second", "gauge",
+           "TFBSs read per second since the last report.", tfbsRate);
+    metric(text, "tfnet_gene_tfbs_overlaps_total", "counter",
+           "Gene-TFBS region overlaps found; an edge is counted again at "
+           "each site that gives it, so this is not a count of edges.",
+           aCounts.overlaps);
+    metric(text, "tfnet_tfbs_used_total", "counter",
+           "TFBSs assigned to genes, in the chromosomes merged so far.",
+           aCounts.tfbsUsed);
+    metric(text, "tfnet_tfbs_unused_total", "counter",
+           "TFBSs not assigned to genes, in the chromosomes merged so far.",
+           aCounts.tfbsUnused);
+    metric(text, "tfnet_read_bytes_total", "counter",
+           "Bytes of GenBank and BaSeTraM files read.", aCounts.bytesRead);
+    metric(text, "tfnet_read_bytes_per_second", "gauge",
+           "Bytes read per second since the last report.", byteRate);
+    metric(text, "tfnet_resident_memory_bytes", "gauge",
+           "Resident set size.", resident);
+
+    std::string tmp(mPath + ".tmp");
+    {
+      std::ofstream out(tmp.c_str());
+      out << text.str();
+      if (!out.good())
+      {
+        std::cerr << "Could not write " << tmp << std::endl;
+        return;
+      }
+    }
+    boost::system::error_code ec;
+    boost::filesystem::rename(tmp, mPath, ec);
+    if (ec)
+      std::cerr << "Could not replace " << mPath << ": " << ec.message()
+                << std::endl;
+  }
+
+  template<typename T> static void
+  metric(std::ostream& aOut, const char* aName, const char* aType,
+         const char* aHelp, T aValue)
+  {
+    aOut << "# HELP " << aName << " " << aHelp << std::endl
+         << "# TYPE " << aName << " " << aType << std::endl
+         << aName << " " << aValue << std::endl;
+  }
+
+  double mStart, mInterval, mLastTime;
+  std::string mPath;
+  Counts mCounts, mLast;
+  bool mStopping, mRunning;
+  boost::mutex mMutex;
+  boost::condition_variable mWake;
+  boost::thread mReporter;
+};
+
+#endif // TFNET_BUILD_METRICS_HPP
@@ -0,0 +1,264 @@
+#ifndef TFNET_CONTIG_PREFETCHER_HPP
+#define TFNET_CONTIG_PREFETCHER_HPP
+
+#include <boost/thread.hpp>
+#include <boost/bind/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <list>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Tracer.hpp"
+
+// Reads the BaSeTraM files of upcoming contigs from a thread of its own, so
+// the reading overlaps with parsing the chromosome. Files are read in the
+// order they are asked for, and only while what has been read and not yet
+// taken fits in the budget; a file bigger than the whole budget is left for
+// the caller to read. When keeping, what is read is handed over by take();
+// otherwise it is only read to bring it into the page cache, and the budget
+// bounds how far ahead that goes.
+class ContigPrefetcher
+{
+public:
+  ContigPrefetcher()
+    : mBudget(0), mKeep(false), mBuffered(0), mNextId(0), mStopping(false),
+      mRunning(false)
+  {
+  }
+
+  ~ContigPrefetcher()
+  {
+    stop();
+  }
+
+  void
+  start(uint64_t aBudget, bool aKeep)
+  {
+    mBudget = aBudget;
+    mKeep = aKeep;
+    mRunning = true;
+    mReader = boost::thread(boost::bind(&ContigPrefetcher::run, this));
+  }
+
+  void
+  stop()
+  {
+    if (!mRunning)
+      return;
+    {
+      boost::mutex::scoped_lock lock(mMutex);
+      mStopping = true;
+      mWake.notify_all();
+    }
+    mReader.join();
+    mRunning = false;
+  }
+
+  bool
+  running() const
+  {
+    return mRunning;
+  }
+
+  // Queues aPath to be read once everything asked for before it has been.
+  void
+  request(const std::string& aPath)
+  {
+    if (!mRunning)
+      return;
+    boost::mutex::scoped_lock lock(mMutex);
+    mQueue.push_back(Entry(mNextId++, aPath));
+    mWake.notify_all();
+  }
+
+  // Waits for aPath to be read, dropping whatever was asked for before it
+  // and is no longer wanted. Returns true if aData now holds the file; if
+  // aPath was not asked for, could not be read, or was not kept, the caller
+  // reads it itself (from the page cache, if it was read).
+  bool
+  take(const std::string& aPath, std::vector<char>& aData)
+  {
+    if (!mRunning)
+      return false;
+    boost::mutex::scoped_lock lock(mMutex);
+    std::list<Entry>::iterator i = mQueue.begin();
+    while (i != mQueue.end() && (*i).path != aPath)
+      i++;
+    if (i == mQueue.end())
+      return false;
+    while (mQueue.begin() != i)
+      drop(mQueue.begin());
+
+    while ((*i).state == kQueued || (*i).state == kReading)
+      mWake.wait(lock);
+
+    bool taken = false;
+    if ((*i).state == kRead && mKeep)
+    {
+      aData.swap((*i).data);
+      taken = true;
+    }
+    drop(i);
+    return taken;
+  }
+
+  // Drops everything asked for and not yet taken.
+  void
+  clear()
+  {
+    if (!mRunning)
+      return;
+    boost::mutex::scoped_lock lock(mMutex);
+    while (!mQueue.empty())
+      drop(mQueue.begin());
+  }
+
+private:
+  enum State { kQueued, kReading, kRead, kSkipped };
+
+  struct Entry
+  {
+    Entry(uint64_t aId, const std::string& aPath)
+      : id(aId), path(aPath), state(kQueued), size(0)
+    {
+    }
+
+    uint64_t id;
+    std::string path;
+    State state;
+    uint64_t size;
+    std::vector<char> data;
+  };
+
+  // Removes an entry, giving back its share of the budget unless it is
+  // still being read, in which case the reader gives it back when it
+  // finds the entry gone. Called with mMutex held.
+  void
+  drop(std::list<Entry>::iterator aEntry)
+  {
+    if ((*aEntry).state == kRead)
+      mBuffered -= (*aEntry).size;
+    mQueue.erase(aEntry);
+    mWake.notify_all();
+  }
+
+  // Called with mMutex held.
+  std::list<Entry>::iterator
+  find(uint64_t aId)
+  {
+    std::list<Entry>::iterator i = mQueue.begin();
+    while (i != mQueue.end() && (*i).id != aId)
+      i++;
+    return i;
+  }
+
+  void
+  run()
+  {
+    if (Tracer::active())
+      Tracer::active()->nameThread("prefetch");
+    boost::mutex::scoped_lock lock(mMutex);
+    while (!mStopping)
+    {
+      std::list<Entry>::iterator i = mQueue.begin();
+      while (i != mQueue.end() && (*i).state != kQueued)
+        i++;
+      if (i == mQueue.end())
+      {
+        mWake.wait(lock);
+        continue;
+      }
+
+      uint64_t id = (*i).id;
+      std::string path((*i).path);
+      (*i).state = kReading;
+      lock.unlock();
+      boost::system::error_code ec;
+      uint64_t size = boost::filesystem::file_size(path, ec);
+      lock.lock();
+
+      if (ec || size > mBudget)
+      {
+        if ((i = find(id)) != mQueue.end())
+          (*i).state = kSkipped;
+        mWake.notify_all();
+        continue;
+      }
+      while (!mStopping && mBuffered + size > mBudget &&
+             find(id) != mQueue.end())
+        mWake.wait(lock);
+      if (mStopping || (i = find(id)) == mQueue.end())
+        continue;
+      mBuffered += size;
+
+      lock.unlock();
+      std::vector<char> data;
+      bool ok = readFile(path, size, data);
+      lock.lock();
+
+      if ((i = find(id)) == mQueue.end() || !ok)
+      {
+        mBuffered -= size;
+        if (i != mQueue.end())
+          (*i).state = kSkipped;
+      }
+      else
+      {
+        (*i).state = kRead;
+        (*i).size = size;
+        (*i).data.swap(data);
+      }
+      mWake.notify_all();
+    }
+  }
+
+  // Reads aSize bytes of aPath into aData, or through a scratch buffer and
+  // away if not keeping them.
+  bool
+  readFile(const std::string& aPath, uint64_t aSize, std::vector<char>& aData)
+  {
+    TraceScope trace("prefetchContig", aPath);
+    int fd = ::open(aPath.c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+#ifdef POSIX_FADV_SEQUENTIAL
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    static const size_t kChunk = 1 << 20;
+    if (mKeep)
+      aData.resize(aSize);
+    else
+      aData.resize(std::min<uint64_t>(aSize, kChunk));
+
+    uint64_t done = 0;
+    while (done < aSize)
+    {
+      char* to = mKeep ? &aData[done] : &aData[0];
+      size_t want = mKeep ? aSize - done :
+        std::min<uint64_t>(aSize - done, aData.size());
+      ssize_t got = ::read(fd, to, want);
+      if (got <= 0)
+        break;
+      done += got;
+    }
+    ::close(fd);
+    if (!mKeep)
+      aData.clear();
+    return done == aSize;
+  }
+
+  uint64_t mBudget;
+  bool mKeep;
+  uint64_t mBuffered, mNextId;
+  std::list<Entry> mQueue;
+  bool mStopping, mRunning;
+  boost::mutex mMutex;
+  boost::condition_variable mWake;
+  boost::thread mReader;
+};
+
+#endif // TFNET_CONTIG_PREFETCHER_HPP
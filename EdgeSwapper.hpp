@@ -0,0 +1,73 @@
+#ifndef TFNET_EDGE_SWAPPER_HPP
+#define TFNET_EDGE_SWAPPER_HPP
+
+#include <boost/random.hpp>
+#include <vector>
+#include <stdint.h>
+#include "PackedEdges.hpp"
+
+// Rewires a network with Maslov-Sneppen double-edge swaps: two edges A <- B
+// and C <- D become A <- D and C <- B, so every gene keeps its number of
+// regulators and of targets. A swap is turned down if it would regulate a
+// gene by itself or add an edge the network already has. The edges are
+// kept in a flat array to pick from, with a PackedEdgeSet of them to check
+// new edges against.
+class EdgeSwapper
+{
+public:
+  // aEdges must be distinct.
+  EdgeSwapper(const std::vector<uint64_t>& aEdges)
+    : mEdges(aEdges), mIndex(aEdges.size())
+  {
+    for (uint32_t i = 0; i < mEdges.size(); i++)
+      mIndex.insert(mEdges[i]);
+  }
+
+  // Makes aAttempts attempts, and returns how many of them swapped.
+  uint64_t
+  swap(uint64_t aAttempts, boost::mt19937& aRng)
+  {
+    if (mEdges.size() < 2)
+      return 0;
+
+    boost::uniform_int<uint32_t> pick(0, mEdges.size() - 1);
+    uint64_t swapped = 0;
+    for (uint64_t n = 0; n < aAttempts; n++)
+    {
+      uint32_t i = pick(aRng), j = pick(aRng);
+      uint64_t a = mEdges[i], b = mEdges[j];
+      uint32_t t1 = edgeTarget(a), r1 = edgeSource(a);
+      uint32_t t2 = edgeTarget(b), r2 = edgeSource(b);
+      // Edges sharing a target or a regulator would only swap back into
+      // themselves, and the other two would make a gene regulate itself.
+      if (t1 == t2 || r1 == r2 || t1 == r2 || t2 == r1)
+        continue;
+
+      uint64_t c = packEdge(t1, r2), d = packEdge(t2, r1);
+      if (mIndex.contains(c) || mIndex.contains(d))
+        continue;
+
+      mIndex.erase(a);
+      mIndex.erase(b);
+      mIndex.insert(c);
+      mIndex.insert(d);
+      mEdges[i] = c;
+      mEdges[j] = d;
+      swapped++;
+    }
+    return swapped;
+  }
+
+  // The edges, in no particular order.
+  const std::vector<uint64_t>&
+  edges() const
+  {
+    return mEdges;
+  }
+
+private:
+  std::vector<uint64_t> mEdges;
+  PackedEdgeSet mIndex;
+};
+
+#endif // TFNET_EDGE_SWAPPER_HPP
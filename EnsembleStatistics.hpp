@@ -0,0 +1,342 @@
+#ifndef TFNET_ENSEMBLE_STATISTICS_HPP
+#define TFNET_ENSEMBLE_STATISTICS_HPP
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+#include "NetworkModel.hpp"
+#include "PackedEdges.hpp"
+
+// What is measured on one network: the in-degree (number of regulators) and
+// out-degree (number of targets) of each of the original network's vertices,
+// its edges, how many of them the original also has, and how many have an
+// edge back the other way. Vertices the original does not have add to the
+// counts of edges but not to any degree. The edges are kept as sorted
+// packed keys, with the other edges turned round
+// alongside to find the reciprocal ones; a thread reuses the vectors from
+// one network to the next.
+struct NetworkMeasures
+{
+  std::vector<uint32_t> inDegree, outDegree;
+  std::vector<uint64_t> edges, reversed;
+  uint64_t edgeCount, overlap, reciprocal;
+};
+
+// The original network, indexed to measure perturbed copies of it against.
+// Its vertices are numbered in order of HGNC ID; a vertex listed twice
+// counts once, under the name it is first listed with.
+class EnsembleReference
+{
+public:
+  EnsembleReference(const NetworkModel& aOriginal)
+  {
+    std::vector<std::pair<uint32_t, uint32_t> > byId;
+    for (uint32_t v = 0; v < aOriginal.vertexCount(); v++)
+      byId.push_back(std::pair<uint32_t, uint32_t>(aOriginal.vertexId(v), v));
+    std::sort(byId.begin(), byId.end());
+
+    for (uint32_t i = 0; i < byId.size(); i++)
+    {
+      if (!mIds.empty() && mIds.back() == byId[i].first)
+        continue;
+      mIds.push_back(byId[i].first);
+      mNames.push_back(aOriginal.vertexName(byId[i].second));
+    }
+
+    measure(aOriginal, mOriginal);
+    mEdges = mOriginal.edges;
+    mOriginal.overlap = mOriginal.edgeCount;
+  }
+
+  // Safe to call from several threads at once, each with its own measures.
+  void
+  measure(const NetworkModel& aNetwork, NetworkMeasures& aMeasures) const
+  {
+    aMeasures.inDegree.assign(mIds.size(), 0);
+    aMeasures.outDegree.assign(mIds.size(), 0);
+    aMeasures.edges.clear();
+    for (uint32_t t = 0; t < aNetwork.targetCount(); t++)
+      for (const uint32_t* r = aNetwork.regulatorsBegin(t);
+           r != aNetwork.regulatorsEnd(t); r++)
+        aMeasures.edges.push_back(packEdge(aNetwork.target(t), *r));
+    radixSort(aMeasures.edges);
+    aMeasures.edges.erase(std::unique(aMeasures.edges.begin(),
+                                      aMeasures.edges.end()),
+                          aMeasures.edges.end());
+
+    aMeasures.edgeCount = aMeasures.edges.size();
+    aMeasures.overlap = countCommon(aMeasures.edges, mEdges);
+
+    // Edges come sorted by target, so its index only needs finding once.
+    aMeasures.reversed.clear();
+    uint32_t lastTarget = 0, t = index(0);
+    for (std::vector<uint64_t>::const_iterator e = aMeasures.edges.begin();
+         e != aMeasures.edges.end();
+         e++)
+    {
+      uint32_t target = edgeTarget(*e), regulator = edgeSource(*e);
+      if (target != lastTarget)
+      {
+        lastTarget = target;
+        t = index(target);
+      }
+      uint32_t r = index(regulator);
+      if (t != kNoVertex)
+        aMeasures.inDegree[t]++;
+      if (r != kNoVertex)
+        aMeasures.outDegree[r]++;
+      if (target != regulator)
+        aMeasures.reversed.push_back(packEdge(regulator, target));
+    }
+    radixSort(aMeasures.reversed);
+    aMeasures.reciprocal = countCommon(aMeasures.edges, aMeasures.reversed);
+  }
+
+  const NetworkMeasures&
+  original() const
+  {
+    return mOriginal;
+  }
+
+  uint32_t
+  vertexCount() const
+  {
+    return mIds.size();
+  }
+
+  uint32_t
+  vertexId(uint32_t aIndex) const
+  {
+    return mIds[aIndex];
+  }
+
+  const std::string&
+  vertexName(uint32_t aIndex) const
+  {
+    return mNames[aIndex];
+  }
+
+private:
+  static const uint32_t kNoVertex = 0xFFFFFFFF;
+
+  // The number of keys in both of two sorted vectors.
+  static uint64_t
+  countCommon(const std::vector<uint64_t>& aA, const std::vector<uint64_t>& aB)
+  {
+    uint64_t common = 0;
+    std::vector<uint64_t>::const_iterator a = aA.begin(), b = aB.begin();
+    while (a != aA.end() && b != aB.end())
+    {
+      if (*a < *b)
+        a++;
+      else if (*b < *a)
+        b++;
+      else
+      {
+        common++;
+        a++;
+        b++;
+      }
+    }
+    return common;
+  }
+
+  uint32_t
+  index(uint32_t aHGNCId) const
+  {
+    std::vector<uint32_t>::const_iterator i =
+      std::lower_bound(mIds.begin(), mIds.end(), aHGNCId);
+    if (i == mIds.end() || *i != aHGNCId)
+      return kNoVertex;
+    return i - mIds.begin();
+  }
+
+  std::vector<uint32_t> mIds;
+  std::vector<std::string> mNames;
+  std::vector<uint64_t> mEdges;
+  NetworkMeasures mOriginal;
+};
+
+// Sums the measures of an ensemble of perturbed networks. Everything is
+// kept as integer sums and sums of squares, so the summary comes out the
+// same whatever order the replicates are added in; the means and standard
+// deviations are only worked out when it is written.
+class EnsembleStatistics
+{
+public:
+  EnsembleStatistics()
+    : mReplicates(0)
+  {
+    mEdges[0] = mEdges[1] = 0;
+    mOverlap[0] = mOverlap[1] = 0;
+    mReciprocal[0] = mReciprocal[1] = 0;
+  }
+
+  void
+  add(const NetworkMeasures& aMeasures)
+  {
+    mReplicates++;
+    addSquare(mEdges, aMeasures.edgeCount);
+    addSquare(mOverlap, aMeasures.overlap);
+    addSquare(mReciprocal, aMeasures.reciprocal);
+
+    uint32_t vertices = aMeasures.inDegree.size();
+    if (mIn.size() < vertices * 2)
+    {
+      mIn.resize(vertices * 2, 0);
+      mOut.resize(vertices * 2, 0);
+    }
+    for (uint32_t v = 0; v < vertices; v++)
+    {
+      addSquare(&mIn[v * 2], aMeasures.inDegree[v]);
+      addSquare(&mOut[v * 2], aMeasures.outDegree[v]);
+      count(mInHistogram, aMeasures.inDegree[v]);
+      count(mOutHistogram, aMeasures.outDegree[v]);
+    }
+  }
+
+  // Writes the summary, in a format like that of the network files:
+  //   ENSEMBLE <label>
+  //   REPLICATES <n>
+  //   EDGES <original> <mean> <sd>
+  //   OVERLAP <original> <mean> <sd> <mean fraction of original edges kept>
+  //   RECIPROCAL <original> <mean> <sd>
+  //   RECIPROCITY <original> <all replicates' reciprocal / edges>
+  //   INDEGREES, then DEGREE <k> <vertices in original> <mean vertices>
+  //     for each degree seen, then ENDINDEGREES (OUTDEGREES likewise)
+  //   VERTICES, then for each vertex
+  //     VERTEX <HGNC ID> <name> <in: original mean sd z> <out: likewise>
+  //   then ENDVERTICES and ENDENSEMBLE.
+  // A z-score with no spread to measure it by is written as NA.
+  void
+  write(std::ostream& aOut, const EnsembleReference& aReference,
+        const std::string& aLabel) const
+  {
+    const NetworkMeasures& original(aReference.original());
+    std::streamsize precision = aOut.precision(10);
+
+    aOut << "ENSEMBLE " << aLabel << std::endl
+         << "REPLICATES " << mReplicates << std::endl;
+    aOut << "EDGES " << original.edgeCount;
+    writeSpread(aOut, mEdges);
+    aOut << std::endl << "OVERLAP " << original.overlap;
+    writeSpread(aOut, mOverlap);
+    aOut << " " << (original.edgeCount == 0 ? 0.0 :
+                    mean(mOverlap) / original.edgeCount) << std::endl;
+    aOut << "RECIPROCAL " << original.reciprocal;
+    writeSpread(aOut, mReciprocal);
+    aOut << std::endl << "RECIPROCITY "
+         << ratio(original.reciprocal, original.edgeCount) << " "
+         << ratio(mReciprocal[0], mEdges[0]) << std::endl;
+
+    writeHistogram(aOut, "INDEGREES", original.inDegree, mInHistogram);
+    writeHistogram(aOut, "OUTDEGREES", original.outDegree, mOutHistogram);
+
+    aOut << "VERTICES" << std::endl;
+    for (uint32_t v = 0; v < aReference.vertexCount(); v++)
+    {
+      aOut << "VERTEX " << aReference.vertexId(v) << " "
+           << aReference.vertexName(v);
+      writeVertex(aOut, original.inDegree[v], mIn, v);
+      writeVertex(aOut, original.outDegree[v], mOut, v);
+      aOut << std::endl;
+    }
+    aOut << "ENDVERTICES" << std::endl
+         << "ENDENSEMBLE" << std::endl;
+    aOut.precision(precision);
+  }
+
+private:
+  static void
+  addSquare(uint64_t* aSums, uint64_t aValue)
+  {
+    aSums[0] += aValue;
+    aSums[1] += aValue * aValue;
+  }
+
+  static void
+  count(std::vector<uint64_t>& aHistogram, uint32_t aDegree)
+  {
+    if (aHistogram.size() <= aDegree)
+      aHistogram.resize(aDegree + 1, 0);
+    aHistogram[aDegree]++;
+  }
+
+  static double
+  ratio(uint64_t aNumerator, uint64_t aDenominator)
+  {
+    return aDenominator == 0 ? 0.0 :
+      static_cast<double>(aNumerator) / aDenominator;
+  }
+
+  double
+  mean(const uint64_t* aSums) const
+  {
+    return ratio(aSums[0], mReplicates);
+  }
+
+  // The sample standard deviation.
+  double
+  sd(const uint64_t* aSums) const
+  {
+    if (mReplicates < 2)
+      return 0.0;
+    double m = mean(aSums);
+    double variance = (aSums[1] - aSums[0] * m) / (mReplicates - 1);
+    return variance > 0 ? sqrt(variance) : 0.0;
+  }
+
+  void
+  writeSpread(std::ostream& aOut, const uint64_t* aSums) const
+  {
+    aOut << " " << mean(aSums) << " " << sd(aSums);
+  }
+
+  void
+  writeHistogram(std::ostream& aOut, const char* aName,
+                 const std::vector<uint32_t>& aOriginal,
+                 const std::vector<uint64_t>& aHistogram) const
+  {
+    std::vector<uint64_t> original;
+    for (uint32_t v = 0; v < aOriginal.size(); v++)
+      count(original, aOriginal[v]);
+
+    aOut << aName << std::endl;
+    for (uint32_t k = 0; k < std::max(original.size(), aHistogram.size());
+         k++)
+    {
+      uint64_t o = k < original.size() ? original[k] : 0;
+      uint64_t h = k < aHistogram.size() ? aHistogram[k] : 0;
+      if (o == 0 && h == 0)
+        continue;
+      aOut << "DEGREE " << k << " " << o << " " << ratio(h, mReplicates)
+           << std::endl;
+    }
+    aOut << "END" << aName << std::endl;
+  }
+
+  void
+  writeVertex(std::ostream& aOut, uint32_t aOriginal,
+              const std::vector<uint64_t>& aSums, uint32_t aVertex) const
+  {
+    static const uint64_t kNone[2] = { 0, 0 };
+    const uint64_t* sums = aSums.empty() ? kNone : &aSums[aVertex * 2];
+    double m = mean(sums), s = sd(sums);
+    aOut << " " << aOriginal << " " << m << " " << s << " ";
+    if (s > 0)
+      aOut << (aOriginal - m) / s;
+    else
+      aOut << "NA";
+  }
+
+  uint64_t mReplicates;
+  uint64_t mEdges[2], mOverlap[2], mReciprocal[2];
+  // Per vertex sums and sums of squares of the degrees, interleaved.
+  std::vector<uint64_t> mIn, mOut;
+  std::vector<uint64_t> mInHistogram, mOutHistogram;
+};
+
+#endif // TFNET_ENSEMBLE_STATISTICS_HPP
@@ -0,0 +1,268 @@
+#ifndef TFNET_GENE_EXTRACTOR_HPP
+#define TFNET_GENE_EXTRACTOR_HPP
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/filesystem.hpp>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <sys/mman.h>
+#include "../parsegenbank/GenbankParser.hpp"
+
+// Pulls the gene annotations out of a chromosome GenBank file without
+// reading its sequence. The file is mapped, each ORIGIN block is skipped in
+// one memchr() to its closing "//", and the feature table is walked with
+// the GenBank parser's line rules. Only three kinds of call are made on the
+// sink, in the order the parser would make them: OpenKeyword() for LOCUS,
+// OpenFeature() for gene features, and Qualifier() for every /db_xref.
+class GeneExtractor
+{
+public:
+  bool
+  extractFile(const std::string& aPath, GenBankSink& aSink, std::string& aError)
+  {
+    boost::iostreams::mapped_file_source file;
+    if (!mapFile(aPath, file, aError))
+      return false;
+    if (file.is_open())
+      extract(file.data(), file.data() + file.size(), aSink);
+    return true;
+  }
+
+  // Lists the names of the contigs in a chromosome file, in order, from
+  // their LOCUS lines alone, skipping everything else.
+  static bool
+  locusNames(const std::string& aPath, std::vector<std::string>& aNames,
+             std::string& aError)
+  {
+    boost::iostreams::mapped_file_source file;
+    if (!mapFile(aPath, file, aError))
+      return false;
+    if (!file.is_open())
+      return true;
+
+    const char* line = file.data(), * end = file.data() + file.size();
+    while (line < end)
+    {
+      const char* eol =
+        static_cast<const char*>(memchr(line, '\n', end - line));
+      if (eol == NULL)
+        eol = end;
+
+      if (eol - line > 5 && !memcmp(line, "LOCUS ", 6))
+      {
+        const char* name = line + 5;
+        while (name != eol && *name == ' ')
+          name++;
+        const char* nameEnd = name;
+        while (nameEnd != eol && *nameEnd != ' ')
+          nameEnd++;
+        aNames.push_back(std::string(name, nameEnd));
+      }
+      else if (eol - line >= 6 && !memcmp(line, "ORIGIN", 6) &&
+               (eol - line == 6 || line[6] == ' '))
+        eol = skipSequence(eol, end);
+      line = eol + 1;
+    }
+    return true;
+  }
+
+  void
+  extract(const char* aBegin, const char* aEnd, GenBankSink& aSink)
+  {
+    mSink = &aSink;
+    mInFeatures = false;
+    mInLocation = false;
+    mGenePending = false;
+    mIsGene = false;
+    mDbXrefPending = false;
+
+    const char* line = aBegin;
+    while (line < aEnd)
+    {
+      const char* eol =
+        static_cast<const char*>(memchr(line, '\n', aEnd - line));
+      if (eol == NULL)
+        eol = aEnd;
+
+      if (extractLine(line, eol))
+        eol = skipSequence(eol, aEnd);
+      line = eol + 1;
+    }
+
+    flush();
+    mSink = NULL;
+  }
+
+private:
+  // Maps aPath for reading straight through; an empty file is left closed.
+  static bool
+  mapFile(const std::string& aPath,
+          boost::iostreams::mapped_file_source& aFile, std::string& aError)
+  {
+    boost::system::error_code ec;
+    uintmax_t size = boost::filesystem::file_size(aPath, ec);
+    if (ec)
+    {
+      aError = "Cannot open " + aPath;
+      return false;
+    }
+    if (size == 0)
+      return true;
+
+    try
+    {
+      aFile.open(aPath);
+    }
+    catch (const std::exception& e)
+    {
+      aError = "Cannot map " + aPath + ": " + e.what();
+      return false;
+    }
+    ::madvise(const_cast<char*>(aFile.data()), aFile.size(), MADV_SEQUENTIAL);
+    return true;
+  }
+
+  // Finds the end of the "//" line closing a sequence. Sequence lines hold
+  // only bases, digits and spaces, so the first '/' at the start of a line
+  // is almost always it.
+  static const char*
+  skipSequence(const char* aFrom, const char* aEnd)
+  {
+    const char* p = aFrom;
+    while (p < aEnd)
+    {
+      p = static_cast<const char*>(memchr(p, '/', aEnd - p));
+      if (p == NULL)
+        return aEnd;
+      if (p[-1] == '\n' && aEnd - p >= 2 && p[1] == '/' &&
+          (aEnd - p == 2 || p[2] == '\n'))
+        return p + 2;
+      p++;
+    }
+    return aEnd;
+  }
+
+  // Returns true if the line starts a sequence block to be skipped.
+  bool
+  extractLine(const char* aBegin, const char* aEnd)
+  {
+    if (aEnd - aBegin == 2 && aBegin[0] == '/' && aBegin[1] == '/')
+    {
+      flush();
+      mInFeatures = false;
+      return false;
+    }
+
+    if (aBegin != aEnd && *aBegin != ' ')
+    {
+      flush();
+      const char* space =
+        static_cast<const char*>(memchr(aBegin, ' ', aEnd - aBegin));
+      const char* nameEnd = space ? space : aEnd;
+      std::string name(aBegin, nameEnd);
+      mInFeatures = (name == "FEATURES");
+
+      if (name == "LOCUS")
+      {
+        const char* value = nameEnd;
+        while (value != aEnd && *value == ' ')
+          value++;
+        std::string v(value, aEnd);
+        mSink->OpenKeyword("LOCUS", v.c_str());
+      }
+
+      return name == "ORIGIN";
+    }
+
+    if (!mInFeatures)
+      return false;
+
+    if (aEnd - aBegin > 5 && !memcmp(aBegin, "     ", 5) && aBegin[5] != ' ')
+    {
+      flush();
+      const char* name = aBegin + 5;
+      const char* p = name;
+      while (p != aEnd && *p != ' ')
+        p++;
+      mIsGene = (p - name == 4 && !memcmp(name, "gene", 4));
+      mGenePending = mIsGene;
+      while (p != aEnd && *p == ' ')
+        p++;
+      if (mIsGene)
+        mLocation.assign(p, aEnd);
+      mInLocation = true;
+      return false;
+    }
+
+    const char* p = aBegin;
+    while (p != aEnd && *p == ' ')
+      p++;
+    if (p == aEnd)
+      return false;
+
+    if (*p == '/')
+    {
+      mInLocation = false;
+      openGene();
+      flushDbXref();
+
+      const char* name = p + 1;
+      const char* eq = static_cast<const char*>(memchr(name, '=', aEnd - name));
+      if ((eq ? eq : aEnd) - name == 7 && !memcmp(name, "db_xref", 7))
+      {
+        mDbXrefPending = true;
+        mValue.assign(eq ? eq + 1 : aEnd, aEnd);
+      }
+    }
+    else if (mInLocation)
+    {
+      if (mIsGene)
+        mLocation.append(p, aEnd);
+    }
+    else if (mDbXrefPending)
+    {
+      mValue += ' ';
+      mValue.append(p, aEnd);
+    }
+
+    return false;
+  }
+
+  void
+  openGene()
+  {
+    if (!mGenePending)
+      return;
+    mGenePending = false;
+    mSink->OpenFeature("gene", mLocation.c_str());
+  }
+
+  void
+  flushDbXref()
+  {
+    if (!mDbXrefPending)
+      return;
+    mDbXrefPending = false;
+
+    if (mValue.size() >= 2 && mValue[0] == '"' &&
+        mValue[mValue.size() - 1] == '"')
+      mValue = mValue.substr(1, mValue.size() - 2);
+    mSink->Qualifier("db_xref", mValue.c_str());
+  }
+
+  void
+  flush()
+  {
+    openGene();
+    flushDbXref();
+    mIsGene = false;
+    mInLocation = false;
+  }
+
+  GenBankSink* mSink;
+  bool mInFeatures, mInLocation, mGenePending, mIsGene, mDbXrefPending;
+  std::string mLocation, mValue;
+};
+
+#endif // TFNET_GENE_EXTRACTOR_HPP
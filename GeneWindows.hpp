@@ -0,0 +1,79 @@
+#ifndef TFNET_GENE_WINDOWS_HPP
+#define TFNET_GENE_WINDOWS_HPP
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+class Gene
+{
+public:
+  Gene(uint32_t aOffset, uint32_t aHgncId = 1)
+    : offset(aOffset), hgncId(aHgncId)
+  {
+  }
+
+  bool
+  operator<(const Gene& aGene) const
+  {
+    return (offset < aGene.offset);
+  }
+
+  uint32_t offset;
+  uint32_t hgncId;
+};
+
+// A run of genes [low, high) in a sorted gene vector.
+typedef std::pair<uint32_t, uint32_t> GeneWindow;
+
+// Finds the genes whose offsets lie within aBefore bases before and aAfter
+// bases after aStart (clamped at zero) by searching for the upper end and
+// walking back from it.
+inline GeneWindow
+findGeneWindow(const std::vector<Gene>& aGenes, uint32_t aStart,
+               uint32_t aBefore, uint32_t aAfter)
+{
+  size_t offset((aStart > aBefore) ? aStart - aBefore : 0);
+  uint32_t high = std::upper_bound(aGenes.begin(), aGenes.end(),
+                                   Gene(aStart + aAfter)) - aGenes.begin();
+  uint32_t low = high;
+  while (low > 0 && aGenes[low - 1].offset >= offset)
+    low--;
+
+  return GeneWindow(low, high);
+}
+
+// Batch version of findGeneWindow: aSites holds (start << 32 | index) keys
+// sorted by start, and the window for each site is stored at its index in
+// aWindows. Both ends of the window only ever move forward as the start
+// increases, so all the sites are assigned in one merge-like pass over the
+// gene vector.
+inline void
+sweepGeneWindows(const std::vector<Gene>& aGenes,
+                 const std::vector<uint64_t>& aSites,
+                 uint32_t aBefore, uint32_t aAfter,
+                 std::vector<GeneWindow>& aWindows)
+{
+  uint32_t low = 0, high = 0, nGenes = aGenes.size();
+
+  for
+  (
+   std::vector<uint64_t>::const_iterator i = aSites.begin();
+   i != aSites.end();
+   i++
+  )
+  {
+    uint32_t start = (*i) >> 32;
+    size_t offset((start > aBefore) ? start - aBefore : 0);
+    uint32_t end = start + aAfter;
+
+    while (high < nGenes && aGenes[high].offset <= end)
+      high++;
+    while (low < high && aGenes[low].offset < offset)
+      low++;
+
+    aWindows[(*i) & 0xFFFFFFFF] = GeneWindow(low, high);
+  }
+}
+
+#endif // TFNET_GENE_WINDOWS_HPP
@@ -0,0 +1,315 @@
+#ifndef TFNET_HGNC_LOADER_HPP
+#define TFNET_HGNC_LOADER_HPP
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind/bind.hpp>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+#include "Tracer.hpp"
+
+// Loads the HGNC names TSV (HGNC ID, approved symbol, approved name, status,
+// previous symbols, aliases) into the builder's name to HGNC ID map. The file
+// is mapped and cut into chunks at line boundaries, each chunk is parsed on
+// its own thread, and the chunks' results are merged in file order, so the
+// outcome is the same as reading the rows one at a time: an approved symbol
+// takes the name over from whatever had it, and every other name (the
+// approved name, previous symbols and aliases) only goes to an ID if nothing
+// had it yet. Names are upper-cased and have their dashes removed, and the
+// first approved symbol seen for an ID is kept as its display name.
+class HGNCLoader
+{
+public:
+  bool
+  load(const std::string& aPath, uint32_t aThreads,
+       std::map<std::string, uint32_t>& aIdByName,
+       std::map<uint32_t, std::string>& aNameById, std::string& aError)
+  {
+    boost::system::error_code ec;
+    uintmax_t size = boost::filesystem::file_size(aPath, ec);
+    if (ec)
+    {
+      aError = "Cannot open " + aPath;
+      return false;
+    }
+    if (size == 0)
+      return true;
+
+    boost::iostreams::mapped_file_source file;
+    try
+    {
+      file.open(aPath);
+    }
+    catch (const std::exception& e)
+    {
+      aError = "Cannot map " + aPath + ": " + e.what();
+      return false;
+    }
+
+    // Skip the header...
+    const char* begin = file.data(), * end = begin + file.size();
+    const char* rows = static_cast<const char*>(memchr(begin, '\n', size));
+    if (rows == NULL)
+      return true;
+    rows++;
+
+    if (aThreads == 0)
+      aThreads = 1;
+    std::vector<Chunk> chunks(aThreads);
+    const char* from = rows;
+    for (uint32_t c = 0; c < aThreads; c++)
+    {
+      const char* to = end;
+      if (c + 1 < aThreads)
+      {
+        to = from + (end - from) / (aThreads - c);
+        const char* eol =
+          static_cast<const char*>(memchr(to, '\n', end - to));
+        to = eol ? eol + 1 : end;
+      }
+      chunks[c].begin = from;
+      chunks[c].end = to;
+      from = to;
+    }
+
+    if (aThreads == 1)
+      chunks[0].parse();
+    else
+    {
+      boost::thread_group workers;
+      for (uint32_t c = 0; c < aThreads; c++)
+        workers.create_thread(boost::bind(&Chunk::parse, &chunks[c]));
+      workers.join_all();
+    }
+
+    TraceScope trace("HGNCLoader::merge");
+    merge(chunks, aIdByName, aNameById);
+    return true;
+  }
+
+private:
+  // What a chunk found for one name: the last approved symbol to claim it
+  // and the first of the other columns to.
+  struct NameIds
+  {
+    std::string name;
+    bool hasSymbolId, hasOtherId;
+    uint32_t symbolId, otherId;
+  };
+
+  // A name as found in a row, numbered so that a chunk's findings can be
+  // sorted by name while keeping them in file order.
+  struct Found
+  {
+    std::string name;
+    uint32_t order, hgncId;
+    bool isSymbol;
+
+    bool
+    operator<(const Found& aOther) const
+    {
+      int c = name.compare(aOther.name);
+      return c < 0 || (c == 0 && order < aOther.order);
+    }
+  };
+
+  class Chunk
+  {
+  public:
+    void
+    parse()
+    {
+      TraceScope trace("HGNCLoader::parse");
+      std::vector<Found> found;
+      const char* line = begin;
+      while (line < end)
+      {
+        const char* eol =
+          static_cast<const char*>(memchr(line, '\n', end - line));
+        if (eol == NULL)
+          eol = end;
+        parseRow(line, eol, found);
+        line = eol + 1;
+      }
+
+      std::sort(found.begin(), found.end());
+      for (size_t i = 0; i < found.size(); i++)
+      {
+        if (names.empty() || found[i].name != names.back().name)
+        {
+          NameIds ids;
+          ids.name.swap(found[i].name);
+          ids.hasSymbolId = ids.hasOtherId = false;
+          ids.symbolId = ids.otherId = 0;
+          names.push_back(ids);
+        }
+        NameIds& ids(names.back());
+        if (found[i].isSymbol)
+        {
+          ids.hasSymbolId = true;
+          ids.symbolId = found[i].hgncId;
+        }
+        else if (!ids.hasOtherId)
+        {
+          ids.hasOtherId = true;
+          ids.otherId = found[i].hgncId;
+        }
+      }
+    }
+
+    const char* begin, * end;
+    std::vector<NameIds> names;
+    std::vector<std::pair<uint32_t, std::string> > symbols;
+
+  private:
+    void
+    parseRow(const char* aBegin, const char* aEnd, std::vector<Found>& aFound)
+    {
+      static const uint32_t kColumns = 6;
+      const char* column[kColumns], * columnEnd[kColumns];
+      const char* p = aBegin;
+      for (uint32_t c = 0; c < kColumns; c++)
+      {
+        const char* tab = static_cast<const char*>(memchr(p, '\t', aEnd - p));
+        if (tab == NULL && c + 1 < kColumns)
+          return;
+        column[c] = p;
+        columnEnd[c] = tab ? tab : aEnd;
+        p = columnEnd[c] + 1;
+      }
+
+      if (columnEnd[3] - column[3] != 8 || memcmp(column[3], "Approved", 8))
+        return;
+
+      uint32_t hgncId = parseId(column[0], columnEnd[0]);
+      symbols.push_back(std::pair<uint32_t, std::string>
+                        (hgncId, std::string(column[1], columnEnd[1])));
+      add(column[1], columnEnd[1], hgncId, true, aFound);
+      add(column[2], columnEnd[2], hgncId, false, aFound);
+      addList(column[4], columnEnd[4], hgncId, aFound);
+      addList(column[5], columnEnd[5], hgncId, aFound);
+    }
+
+    // strtoul() on the column, which is almost always just a few digits.
+    static uint32_t
+    parseId(const char* aBegin, const char* aEnd)
+    {
+      uint32_t v = 0;
+      const char* p = aBegin;
+      while (p != aEnd && p - aBegin < 9 && *p >= '0' && *p <= '9')
+        v = v * 10 + (*p++ - '0');
+      if (p == aBegin || p != aEnd)
+        v = strtoul(std::string(aBegin, aEnd).c_str(), NULL, 10);
+      return v;
+    }
+
+    // Adds each name in a list separated by runs of commas and spaces. A
+    // list starting with a separator has an empty name first; one ending
+    // with a separator does not have one last.
+    void
+    addList(const char* aBegin, const char* aEnd, uint32_t aHGNCId,
+            std::vector<Found>& aFound)
+    {
+      const char* p = aBegin;
+      while (p != aEnd)
+      {
+        const char* name = p;
+        while (p != aEnd && *p != ',' && *p != ' ')
+          p++;
+        add(name, p, aHGNCId, false, aFound);
+        while (p != aEnd && (*p == ',' || *p == ' '))
+          p++;
+      }
+    }
+
+    void
+    add(const char* aBegin, const char* aEnd, uint32_t aHGNCId, bool aSymbol,
+        std::vector<Found>& aFound)
+    {
+      aFound.push_back(Found());
+      Found& f(aFound.back());
+      f.order = aFound.size();
+      f.hgncId = aHGNCId;
+      f.isSymbol = aSymbol;
+      f.name.reserve(aEnd - aBegin);
+      for (const char* p = aBegin; p != aEnd; p++)
+      {
+        if (*p == '-')
+          continue;
+        f.name += (*p >= 'a' && *p <= 'z') ? static_cast<char>(*p - 'a' + 'A') : *p;
+      }
+    }
+  };
+
+  // Merges the chunks' name lists, which are each sorted, taking each name's
+  // findings in chunk order.
+  static void
+  merge(std::vector<Chunk>& aChunks, std::map<std::string, uint32_t>& aIdByName,
+        std::map<uint32_t, std::string>& aNameById)
+  {
+    for (uint32_t c = 0; c < aChunks.size(); c++)
+    {
+      for (uint32_t i = 0; i < aChunks[c].symbols.size(); i++)
+        aNameById.insert(aChunks[c].symbols[i]);
+    }
+
+    std::vector<size_t> next(aChunks.size(), 0);
+    std::map<std::string, uint32_t>::iterator hint = aIdByName.begin();
+    while (true)
+    {
+      const NameIds* first = NULL;
+      for (uint32_t c = 0; c < aChunks.size(); c++)
+      {
+        if (next[c] == aChunks[c].names.size())
+          continue;
+        const NameIds& ids(aChunks[c].names[next[c]]);
+        if (first == NULL || ids.name < first->name)
+          first = &ids;
+      }
+      if (first == NULL)
+        break;
+
+      bool hasSymbolId = false, hasOtherId = false;
+      uint32_t symbolId = 0, otherId = 0;
+      for (uint32_t c = 0; c < aChunks.size(); c++)
+      {
+        if (next[c] == aChunks[c].names.size())
+          continue;
+        const NameIds& ids(aChunks[c].names[next[c]]);
+        if (ids.name != first->name)
+          continue;
+        if (ids.hasSymbolId)
+        {
+          hasSymbolId = true;
+          symbolId = ids.symbolId;
+        }
+        if (ids.hasOtherId && !hasOtherId)
+        {
+          hasOtherId = true;
+          otherId = ids.otherId;
+        }
+      }
+
+      hint = aIdByName.insert(hint, std::pair<std::string, uint32_t>
+                              (first->name, hasSymbolId ? symbolId : otherId));
+      if (hasSymbolId)
+        (*hint).second = symbolId;
+
+      // Step past the name in every chunk that has it.
+      for (uint32_t c = 0; c < aChunks.size(); c++)
+      {
+        if (next[c] != aChunks[c].names.size() &&
+            aChunks[c].names[next[c]].name == (*hint).first)
+          next[c]++;
+      }
+    }
+  }
+};
+
+#endif // TFNET_HGNC_LOADER_HPP
@@ -0,0 +1,402 @@
+#ifndef TFNET_HGNC_RESOLVER_HPP
+#define TFNET_HGNC_RESOLVER_HPP
+
+#include <boost/regex.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/algorithm/string/replace.hpp>
+#include <map>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+
+// Upper-cases a factor name from matrix.dat and takes its dashes out.
+inline std::string
+cleanupHGNCName(const std::string& aName)
+{
+  std::string uc(boost::algorithm::to_upper_copy(aName));
+  boost::algorithm::replace_all(uc, "-", "");
+
+  return uc;
+}
+
+// The resolution rules as first written, kept as the reference that
+// HGNCResolver is checked against.
+inline uint32_t
+findHGNCIdByName(const std::map<std::string, uint32_t>& aMappings,
+                 const std::string& aName, bool stripDashes = true)
+{
+  // Look up the name from HGNC...
+  std::map<std::string, uint32_t>::const_iterator i
+    (aMappings.find(aName));
+  if (i != aMappings.end())
+    return (*i).second;
+
+  // See if it ends in a number...
+  static const boost::regex endNumber("(\\-?)([0-9]+)$");
+  boost::smatch res;
+  if (boost::regex_search(aName, res, endNumber))
+  {
+    i = aMappings.find(res.prefix().str());
+    if (i != aMappings.end())
+      return (*i).second;
+
+    std::string tryAlso;
+    if (res[2].str() == "alpha")
+      tryAlso = "A";
+    else if (res[2].str() == "beta")
+      tryAlso = "B";
+    else if (res[2].str() == "1")
+      tryAlso = "I";
+    else if (res[2].str() == "2")
+      tryAlso = "II";
+
+    std::string attempt(res.prefix().str());
+    attempt += tryAlso;
+    i = aMappings.find(attempt);
+    if (i != aMappings.end())
+      return (*i).second;
+  }
+
+  // Try adding a suffix like 1 or A...
+  std::string attempt = aName + "1";
+  i = aMappings.find(attempt);
+  if (i != aMappings.end())
+    return (*i).second;
+  
+  attempt = aName + "A";
+  i = aMappings.find(attempt);
+  if (i != aMappings.end())
+    return (*i).second;
+
+  if (stripDashes)
+  {
+    // Strip out all dashes and repeat...
+    std::string dashless(boost::replace_all_copy(aName, "ALPHA", "A"));
+    boost::replace_all(dashless, "-", "");
+    return findHGNCIdByName(aMappings, dashless, false);
+  }
+
+  return 0;
+}
+
+// Resolves factor names from matrix.dat to HGNC IDs by the same rules as
+// findHGNCIdByName(): the name itself; the name less a trailing number,
+// then with a trailing 1 or 2 read as I or II; the name with 1 or A
+// appended; and then all of those again on the name with ALPHA read as A
+// and its dashes taken out. Every HGNC name is compiled into one
+// open-addressed table under each base it can be reached from, so all the
+// candidates for a base come out of a single probe, and the answer for each
+// name asked about is kept in the same table.
+class HGNCResolver
+{
+public:
+  static const uint32_t kNotFound = 0;
+
+  HGNCResolver()
+  {
+    clearSlots(16);
+  }
+
+  void
+  compile(const std::map<std::string, uint32_t>& aMappings)
+  {
+    mPool.clear();
+    mEntries.clear();
+    clearSlots(16);
+
+    for
+    (
+     std::map<std::string, uint32_t>::const_iterator i = aMappings.begin();
+     i != aMappings.end();
+     i++
+    )
+    {
+      const std::string& name((*i).first);
+      const char* p = name.data();
+      size_t n = name.size();
+
+      entry(p, n).ids[kExact] = (*i).second;
+      if (n >= 1 && p[n - 1] == '1')
+        entry(p, n - 1).ids[kPlus1] = (*i).second;
+      if (n >= 1 && p[n - 1] == 'A')
+        entry(p, n - 1).ids[kPlusA] = (*i).second;
+      if (n >= 1 && p[n - 1] == 'I')
+        entry(p, n - 1).ids[kPlusI] = (*i).second;
+      if (n >= 2 && p[n - 2] == 'I' && p[n - 1] == 'I')
+        entry(p, n - 2).ids[kPlusII] = (*i).second;
+    }
+  }
+
+  // Appends the compiled table to aBlock, answers remembered so far and
+  // all, for load() to take back: the entry, slot and pool sizes, then the
+  // entries, the slots and the pool themselves.
+  void
+  save(std::string& aBlock) const
+  {
+    uint32_t sizes[4] = { static_cast<uint32_t>(mEntries.size()),
+                          static_cast<uint32_t>(mSlots.size()),
+                          static_cast<uint32_t>(mPool.size()), 0 };
+    aBlock.append(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+    if (!mEntries.empty())
+      aBlock.append(reinterpret_cast<const char*>(&mEntries[0]),
+                    mEntries.size() * sizeof(Entry));
+    aBlock.append(reinterpret_cast<const char*>(&mSlots[0]),
+                  mSlots.size() * sizeof(uint32_t));
+    aBlock += mPool;
+  }
+
+  // Takes the table back from a block written by save(). Returns false,
+  // leaving the table empty, if the block does not hold together.
+  bool
+  load(const char* aBlock, size_t aSize)
+  {
+    mPool.clear();
+    mEntries.clear();
+    clearSlots(16);
+
+    uint32_t sizes[4];
+    if (aSize < sizeof(sizes))
+      return false;
+    memcpy(sizes, aBlock, sizeof(sizes));
+    uint64_t entries = sizes[0], slots = sizes[1], pool = sizes[2];
+    if (slots < 16 || (slots & (slots - 1)) || entries * 2 > slots ||
+        aSize - sizeof(sizes) !=
+        entries * sizeof(Entry) + slots * sizeof(uint32_t) + pool)
+      return false;
+
+    const char* p = aBlock + sizeof(sizes);
+    mEntries.resize(entries);
+    if (entries)
+      memcpy(&mEntries[0], p, entries * sizeof(Entry));
+    p += entries * sizeof(Entry);
+    mSlots.resize(slots);
+    memcpy(&mSlots[0], p, slots * sizeof(uint32_t));
+    p += slots * sizeof(uint32_t);
+    mPool.assign(p, pool);
+
+    // Each entry has a slot, so the probes always reach an empty one.
+    bool sound = true;
+    uint64_t used = 0;
+    for (size_t i = 0; sound && i < mSlots.size(); i++)
+      if (mSlots[i] != kNoEntry)
+      {
+        sound = mSlots[i] < entries;
+        used++;
+      }
+    sound = sound && used == entries;
+    for (size_t i = 0; sound && i < mEntries.size(); i++)
+      sound = mEntries[i].offset <= pool &&
+        mEntries[i].length <= pool - mEntries[i].offset;
+    if (!sound)
+    {
+      mPool.clear();
+      mEntries.clear();
+      clearSlots(16);
+    }
+    return sound;
+  }
+
+  uint32_t
+  resolve(const std::string& aName)
+  {
+    Entry& e(entry(aName.data(), aName.size()));
+    if (e.ids[kResolved] != kAbsent)
+      return e.ids[kResolved];
+
+    uint32_t id;
+    if (!resolveOnce(aName.data(), aName.size(), id))
+    {
+      std::string dashless;
+      dashless.reserve(aName.size());
+      for (size_t i = 0; i < aName.size(); i++)
+      {
+        if (!aName.compare(i, 5, "ALPHA"))
+        {
+          dashless += 'A';
+          i += 4;
+        }
+        else if (aName[i] != '-')
+          dashless += aName[i];
+      }
+      if (!resolveOnce(dashless.data(), dashless.size(), id))
+        id = kNotFound;
+    }
+
+    // Looking the name up may have grown the table, so find it again.
+    entry(aName.data(), aName.size()).ids[kResolved] = id;
+    return id;
+  }
+
+private:
+  enum Rule { kExact, kPlus1, kPlusA, kPlusI, kPlusII, kResolved, kRuleCount };
+  static const uint32_t kAbsent = 0xFFFFFFFF, kNoEntry = 0xFFFFFFFF;
+
+  struct Entry
+  {
+    uint32_t offset, length;
+    uint32_t ids[kRuleCount];
+  };
+
+  // One pass of the rules, without the dash stripping.
+  bool
+  resolveOnce(const char* aName, size_t aLength, uint32_t& aId) const
+  {
+    const Entry* e = find(aName, aLength);
+    if (e && e->ids[kExact] != kAbsent)
+    {
+      aId = e->ids[kExact];
+      return true;
+    }
+
+    size_t prefix, digits;
+    if (findEndNumber(aName, aLength, prefix, digits))
+    {
+      const Entry* base = find(aName, prefix);
+      if (base)
+      {
+        const char* number = aName + prefix;
+        if (number[0] == '-')
+          number++;
+        Rule also = kExact;
+        if (digits == 1 && number[0] == '1')
+          also = kPlusI;
+        else if (digits == 1 && number[0] == '2')
+          also = kPlusII;
+
+        if (base->ids[kExact] != kAbsent)
+        {
+          aId = base->ids[kExact];
+          return true;
+        }
+        if (base->ids[also] != kAbsent)
+        {
+          aId = base->ids[also];
+          return true;
+        }
+      }
+    }
+
+    if (e && e->ids[kPlus1] != kAbsent)
+    {
+      aId = e->ids[kPlus1];
+      return true;
+    }
+    if (e && e->ids[kPlusA] != kAbsent)
+    {
+      aId = e->ids[kPlusA];
+      return true;
+    }
+    return false;
+  }
+
+  // Finds where "(-?)([0-9]+)$" matches, as boost::regex_search() would:
+  // the leftmost run of digits that ends the string or a line, taking in a
+  // dash before it.
+  static bool
+  findEndNumber(const char* aName, size_t aLength, size_t& aPrefix,
+                size_t& aDigits)
+  {
+    size_t i = 0;
+    while (i < aLength)
+    {
+      if (aName[i] < '0' || aName[i] > '9')
+      {
+        i++;
+        continue;
+      }
+
+      size_t start = i;
+      while (i < aLength && aName[i] >= '0' && aName[i] <= '9')
+        i++;
+      if (i == aLength || aName[i] == '\n' || aName[i] == '\r' ||
+          aName[i] == '\f')
+      {
+        aPrefix = (start > 0 && aName[start - 1] == '-') ? start - 1 : start;
+        aDigits = i - start;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static size_t
+  hash(const char* aData, size_t aLength)
+  {
+    // FNV-1a
+    uint32_t h = 2166136261U;
+    for (size_t i = 0; i < aLength; i++)
+      h = (h ^ static_cast<unsigned char>(aData[i])) * 16777619U;
+    return h;
+  }
+
+  const Entry*
+  find(const char* aName, size_t aLength) const
+  {
+    size_t mask = mSlots.size() - 1;
+    for (size_t i = hash(aName, aLength) & mask; ; i = (i + 1) & mask)
+    {
+      uint32_t slot = mSlots[i];
+      if (slot == kNoEntry)
+        return NULL;
+      const Entry& e(mEntries[slot]);
+      if (e.length == aLength && !memcmp(mPool.data() + e.offset, aName, aLength))
+        return &e;
+    }
+  }
+
+  // Returns the entry for aName, adding an empty one if there is none.
+  Entry&
+  entry(const char* aName, size_t aLength)
+  {
+    const Entry* e = find(aName, aLength);
+    if (e)
+      return mEntries[e - &mEntries[0]];
+
+    Entry added;
+    added.offset = mPool.size();
+    added.length = aLength;
+    for (uint32_t r = 0; r < kRuleCount; r++)
+      added.ids[r] = kAbsent;
+    mPool.append(aName, aLength);
+    mEntries.push_back(added);
+
+    // Keep the table at most half full.
+    uint32_t index = mEntries.size() - 1;
+    if (mEntries.size() * 2 > mSlots.size())
+    {
+      clearSlots(mSlots.size() * 2);
+      for (uint32_t j = 0; j < index; j++)
+        insertSlot(j);
+    }
+    insertSlot(index);
+
+    return mEntries[index];
+  }
+
+  // Empties the table. kNoEntry is copied first, as it has no definition
+  // outside the class for assign() to take a reference to.
+  void
+  clearSlots(size_t aSize)
+  {
+    uint32_t none = kNoEntry;
+    mSlots.assign(aSize, none);
+  }
+
+  void
+  insertSlot(uint32_t aEntry)
+  {
+    size_t mask = mSlots.size() - 1;
+    size_t i = hash(mPool.data() + mEntries[aEntry].offset,
+                    mEntries[aEntry].length) & mask;
+    while (mSlots[i] != kNoEntry)
+      i = (i + 1) & mask;
+    mSlots[i] = aEntry;
+  }
+
+  std::string mPool;
+  std::vector<Entry> mEntries;
+  std::vector<uint32_t> mSlots;
+};
+
+#endif // TFNET_HGNC_RESOLVER_HPP
@@ -0,0 +1,228 @@
+#ifndef TFNET_MATRIX_SCANNER_HPP
+#define TFNET_MATRIX_SCANNER_HPP
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/iostreams/device/file.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <sys/mman.h>
+
+// Receives what a MatrixScanner finds in matrix.dat, in file order: the
+// accession from each AC line, the factor name from each BF and NA line, and
+// the end of each entry at a "//" line. The names point into the scanner's
+// buffer and are only good for the duration of the call.
+class MatrixScanSink
+{
+public:
+  virtual ~MatrixScanSink() {}
+  virtual void Accession(const char* aAccession, size_t aLength) = 0;
+  virtual void FactorName(const char* aName, size_t aLength) = 0;
+  virtual void EndEntry() = 0;
+};
+
+// Reads the TRANSFAC matrix database, plain or gzip-compressed. Each line is
+// dispatched on its two character tag, and the field is found where these
+// patterns (matched against the whole line) would capture it:
+//   AC  "^AC[ \t]+(.*)$"
+//   BF  "^BF[ \t]+[^ ]+ ([^;]*);.*$"
+//   NA  "^NA[ \t]+([^ ]+).*$"
+// A plain file is scanned straight out of a mapping of it; a compressed one
+// is inflated a block at a time, so it is never held whole in memory.
+class MatrixScanner
+{
+public:
+  bool
+  scanFile(const std::string& aPath, MatrixScanSink& aSink,
+           std::string& aError)
+  {
+    char magic[2] = { 0, 0 };
+    {
+      std::ifstream probe(aPath.c_str(), std::ios::binary);
+      if (!probe)
+      {
+        aError = "Cannot open " + aPath;
+        return false;
+      }
+      probe.read(magic, 2);
+    }
+
+    if (magic[0] == '\x1f' && magic[1] == '\x8b')
+      return scanCompressed(aPath, aSink, aError);
+
+    boost::system::error_code ec;
+    uintmax_t size = boost::filesystem::file_size(aPath, ec);
+    if (ec)
+    {
+      aError = "Cannot open " + aPath;
+      return false;
+    }
+    if (size == 0)
+      return true;
+
+    boost::iostreams::mapped_file_source file;
+    try
+    {
+      file.open(aPath);
+    }
+    catch (const std::exception& e)
+    {
+      aError = "Cannot map " + aPath + ": " + e.what();
+      return false;
+    }
+    ::madvise(const_cast<char*>(file.data()), file.size(), MADV_SEQUENTIAL);
+
+    scan(file.data(), file.data() + file.size(), aSink);
+    return true;
+  }
+
+  // Scans every line in [aBegin, aEnd); the last need not end in a newline.
+  void
+  scan(const char* aBegin, const char* aEnd, MatrixScanSink& aSink)
+  {
+    const char* line = aBegin;
+    while (line < aEnd)
+    {
+      const char* eol =
+        static_cast<const char*>(memchr(line, '\n', aEnd - line));
+      if (eol == NULL)
+        eol = aEnd;
+      scanLine(line, eol, aSink);
+      line = eol + 1;
+    }
+  }
+
+private:
+  static const size_t kBlockSize = 1 << 20;
+
+  bool
+  scanCompressed(const std::string& aPath, MatrixScanSink& aSink,
+                 std::string& aError)
+  {
+    try
+    {
+      boost::iostreams::filtering_istream in;
+      in.push(boost::iostreams::gzip_decompressor());
+      in.push(boost::iostreams::file_source(aPath, std::ios::binary));
+      // The stream would otherwise swallow a decompression error into its
+      // badbit, and a damaged file would read as a short database.
+      in.exceptions(std::ios::badbit);
+
+      std::vector<char> buffer(kBlockSize);
+      size_t held = 0;
+      while (true)
+      {
+        // A line longer than the buffer just makes it grow.
+        if (held == buffer.size())
+          buffer.resize(buffer.size() * 2);
+        in.read(&buffer[held], buffer.size() - held);
+        size_t got = in.gcount();
+        if (got == 0)
+          break;
+        held += got;
+
+        // Scan the complete lines, and carry the partial one over.
+        size_t complete = held;
+        while (complete > 0 && buffer[complete - 1] != '\n')
+          complete--;
+        if (complete == 0)
+          continue;
+        scan(&buffer[0], &buffer[0] + complete, aSink);
+        memmove(&buffer[0], &buffer[0] + complete, held - complete);
+        held -= complete;
+      }
+      if (in.bad())
+      {
+        aError = "Cannot decompress " + aPath;
+        return false;
+      }
+      if (held != 0)
+        scan(&buffer[0], &buffer[0] + held, aSink);
+    }
+    catch (const std::exception& e)
+    {
+      aError = "Cannot decompress " + aPath + ": " + e.what();
+      return false;
+    }
+    return true;
+  }
+
+  static bool
+  isBlank(char aChar)
+  {
+    return aChar == ' ' || aChar == '\t';
+  }
+
+  void
+  scanLine(const char* aBegin, const char* aEnd, MatrixScanSink& aSink)
+  {
+    size_t length = aEnd - aBegin;
+    if (length == 2 && aBegin[0] == '/' && aBegin[1] == '/')
+    {
+      aSink.EndEntry();
+      return;
+    }
+    if (length < 3 || !isBlank(aBegin[2]))
+      return;
+
+    // "[ \t]+" takes all the blanks it can; the patterns below only need
+    // it to give some back when what follows fails to match.
+    const char* blanks = aBegin + 3;
+    while (blanks != aEnd && isBlank(*blanks))
+      blanks++;
+
+    if (aBegin[0] == 'A' && aBegin[1] == 'C')
+      aSink.Accession(blanks, aEnd - blanks);
+    else if (aBegin[0] == 'B' && aBegin[1] == 'F')
+      scanBF(aBegin + 3, blanks, aEnd, aSink);
+    else if (aBegin[0] == 'N' && aBegin[1] == 'A')
+      scanNA(aBegin + 3, blanks, aEnd, aSink);
+  }
+
+  // "[^ ]+ ([^;]*);.*" after the tag and at least one blank: the name runs
+  // from the space ending the first word to the next ';'. If there is no
+  // such space and ';', the word may start at a tab further back instead.
+  static void
+  scanBF(const char* aFirst, const char* aBlanks, const char* aEnd,
+         MatrixScanSink& aSink)
+  {
+    for (const char* word = aBlanks; word >= aFirst; word--)
+    {
+      if (word == aEnd || *word == ' ')
+        continue;
+      const char* space =
+        static_cast<const char*>(memchr(word, ' ', aEnd - word));
+      if (space == NULL)
+        continue;
+      const char* semicolon =
+        static_cast<const char*>(memchr(space + 1, ';', aEnd - space - 1));
+      if (semicolon == NULL)
+        continue;
+      aSink.FactorName(space + 1, semicolon - space - 1);
+      return;
+    }
+  }
+
+  // "([^ ]+).*" after the tag and at least one blank: the name is the first
+  // word, which may start at a tab if the blanks end the line.
+  static void
+  scanNA(const char* aFirst, const char* aBlanks, const char* aEnd,
+         MatrixScanSink& aSink)
+  {
+    for (const char* word = aBlanks; word >= aFirst; word--)
+    {
+      if (word == aEnd || *word == ' ')
+        continue;
+      const char* space =
+        static_cast<const char*>(memchr(word, ' ', aEnd - word));
+      aSink.FactorName(word, (space ? space : aEnd) - word);
+      return;
+    }
+  }
+};
+
+#endif // TFNET_MATRIX_SCANNER_HPP
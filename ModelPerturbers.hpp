@@ -0,0 +1,600 @@
+#ifndef TFNET_MODEL_PERTURBERS_HPP
+#define TFNET_MODEL_PERTURBERS_HPP
+
+#include <boost/random.hpp>
+#include <boost/lambda/lambda.hpp>
+#include <boost/lambda/bind.hpp>
+#include <algorithm>
+#include <iostream>
+#include <list>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <stdint.h>
+#include "NetworkModel.hpp"
+#include "PackedEdges.hpp"
+#include "EdgeSwapper.hpp"
+
+// The ways tfnetperturber can perturb a network. Each kind registers one
+// instance of itself under its name when the program starts.
+class ModelPerturber
+{
+public:
+  ModelPerturber(const char* aName)
+    : mName(aName)
+  {
+    registry().insert(std::pair<std::string, ModelPerturber*>(aName, this));
+  }
+
+  virtual ~ModelPerturber() {}
+
+  static ModelPerturber* findPerturberByName(const std::string& aName)
+  {
+    RegistryType::iterator i = registry().find(aName);
+    if (i == registry().end())
+      return NULL;
+    
+    return (*i).second;
+  }
+
+  static void listAvailablePerturbers(std::ostream& aOut)
+  {
+    aOut << "Available perturbers:" << std::endl;
+    for (RegistryType::iterator i = registry().begin();
+         i != registry().end();
+         i++)
+      aOut << "\t* " << (*i).first << std::endl
+           << "\t\t* Parameter choices: " << (*i).second->getParameterHelp()
+           << std::endl;
+  }
+
+  static void perturberNames(std::vector<std::string>& aNames)
+  {
+    for (RegistryType::iterator i = registry().begin();
+         i != registry().end();
+         i++)
+      aNames.push_back((*i).first);
+  }
+
+  virtual const char* getParameterHelp() = 0;
+  // Builds a perturbed copy of aModel in aResult, which starts out empty,
+  // drawing all its random numbers from aRng. Returns false, with aError
+  // set, if the perturbation asked for is not possible on this model.
+  virtual bool perturb(const NetworkModel& aModel, NetworkModel& aResult,
+                       boost::mt19937& aRng, std::string& aError) = 0;
+  // A copy with its own parameters, for use on another thread. Copies are
+  // not registered.
+  virtual ModelPerturber* clone() const = 0;
+  const char* name()
+  {
+    return mName;
+  }
+
+  virtual void setParams(const std::string& aParams)
+  {
+  }
+
+  // Puts the parameters back to their defaults, so a perturber used more
+  // than once in a chain only has the parameters given for that step.
+  virtual void resetParams()
+  {
+  }
+
+protected:
+  // The distinct HGNC IDs of the vertices, sorted.
+  static void
+  collectVertices(const NetworkModel& aModel, std::vector<uint32_t>& aVertices)
+  {
+    for (uint32_t i = 0; i < aModel.vertexCount(); i++)
+      aVertices.push_back(aModel.vertexId(i));
+    std::sort(aVertices.begin(), aVertices.end());
+    aVertices.erase(std::unique(aVertices.begin(), aVertices.end()),
+                    aVertices.end());
+  }
+
+  // The distinct edges, packed and sorted by target then regulator.
+  static void
+  collectEdges(const NetworkModel& aModel, std::vector<uint64_t>& aEdges)
+  {
+    for (uint32_t i = 0; i < aModel.targetCount(); i++)
+      for (const uint32_t* r = aModel.regulatorsBegin(i);
+           r != aModel.regulatorsEnd(i); r++)
+        aEdges.push_back(packEdge(aModel.target(i), *r));
+    radixSort(aEdges);
+    aEdges.erase(std::unique(aEdges.begin(), aEdges.end()), aEdges.end());
+  }
+
+  static void
+  copyVertices(const NetworkModel& aModel, NetworkModel& aResult)
+  {
+    for (uint32_t v = 0; v < aModel.vertexCount(); v++)
+      aResult.addVertex(aModel.vertexId(v), aModel.vertexName(v));
+  }
+
+  static void
+  copyEdges(const NetworkModel& aModel, NetworkModel& aResult)
+  {
+    for (uint32_t t = 0; t < aModel.targetCount(); t++)
+    {
+      aResult.addTarget(aModel.target(t));
+      for (const uint32_t* r = aModel.regulatorsBegin(t);
+           r != aModel.regulatorsEnd(t); r++)
+        aResult.addRegulator(*r);
+    }
+  }
+
+  // Adds packed edges, which come sorted by target.
+  static void
+  addEdges(const std::vector<uint64_t>& aEdges, NetworkModel& aResult)
+  {
+    for (uint32_t i = 0; i < aEdges.size(); i++)
+    {
+      if (i == 0 || edgeTarget(aEdges[i]) != edgeTarget(aEdges[i - 1]))
+        aResult.addTarget(edgeTarget(aEdges[i]));
+      aResult.addRegulator(edgeSource(aEdges[i]));
+    }
+  }
+
+  // Adds aCount edges between distinct vertices, picked uniformly from the
+  // pairs aEdges does not already have, and sorts aEdges again. aVertices
+  // and aEdges are as collectVertices() and collectEdges() leave them.
+  //
+  // The ordered pairs of distinct vertices are numbered from 0 to
+  // n(n - 1) - 1. While the new edges will leave at least half of them
+  // free, random pairs are drawn and looked up in a hash set of the edges,
+  // which seldom needs more than two draws an edge. Past that, Floyd's
+  // algorithm picks aCount distinct numbers from the free pairs instead,
+  // and they are turned into pairs by stepping over the taken ones.
+  static bool
+  addRandomEdges(const std::vector<uint32_t>& aVertices,
+                 std::vector<uint64_t>& aEdges, uint64_t aCount,
+                 boost::mt19937& aRng, std::string& aError)
+  {
+    if (aCount == 0)
+      return true;
+
+    uint64_t n = aVertices.size(), pairs = n < 2 ? 0 : n * (n - 1);
+    std::vector<uint64_t> taken;
+    for (uint32_t i = 0; i < aEdges.size(); i++)
+    {
+      uint64_t target = vertexIndex(aVertices, edgeTarget(aEdges[i]));
+      uint64_t source = vertexIndex(aVertices, edgeSource(aEdges[i]));
+      if (target == n || source == n || target == source)
+        continue;
+      taken.push_back(target * (n - 1) + (source < target ? source : source - 1));
+    }
+
+    uint64_t free = pairs - taken.size();
+    if (aCount > free)
+    {
+      std::ostringstream error;
+      error << "Cannot add " << aCount << " edges: only " << free
+            << " pairs of vertices are not already connected.";
+      aError = error.str();
+      return false;
+    }
+
+    if (free - aCount >= pairs / 2)
+    {
+      PackedEdgeSet edges(aEdges.size() + aCount);
+      for (uint32_t i = 0; i < aEdges.size(); i++)
+        edges.insert(aEdges[i]);
+
+      boost::uniform_int<uint32_t> ur(0, n - 1);
+      for (uint64_t added = 0; added < aCount; )
+      {
+        uint32_t regulator = aVertices[ur(aRng)];
+        uint32_t regulated = aVertices[ur(aRng)];
+        if (regulator == regulated)
+          continue;
+        uint64_t edge = packEdge(regulated, regulator);
+        if (edges.insert(edge))
+        {
+          aEdges.push_back(edge);
+          added++;
+        }
+      }
+    }
+    else
+    {
+      PackedEdgeSet chosen(aCount);
+      for (uint64_t j = free - aCount; j < free; j++)
+      {
+        boost::uniform_int<uint64_t> ur(0, j);
+        if (!chosen.insert(ur(aRng)))
+          chosen.insert(j);
+      }
+      std::vector<uint64_t> picks;
+      chosen.keys(picks);
+      radixSort(picks);
+
+      // The k-th free pair is the k-th number once the taken ones up to it
+      // are skipped.
+      uint64_t skipped = 0;
+      for (uint32_t i = 0; i < picks.size(); i++)
+      {
+        while (skipped < taken.size() && taken[skipped] <= picks[i] + skipped)
+          skipped++;
+        uint64_t pair = picks[i] + skipped;
+        uint64_t target = pair / (n - 1), source = pair % (n - 1);
+        if (source >= target)
+          source++;
+        aEdges.push_back(packEdge(aVertices[target], aVertices[source]));
+      }
+    }
+
+    radixSort(aEdges);
+    return true;
+  }
+
+private:
+  // The position of an ID in the sorted vertex IDs, or their count if it is
+  // not there.
+  static uint64_t
+  vertexIndex(const std::vector<uint32_t>& aVertices, uint32_t aId)
+  {
+    std::vector<uint32_t>::const_iterator i =
+      std::lower_bound(aVertices.begin(), aVertices.end(), aId);
+    if (i == aVertices.end() || *i != aId)
+      return aVertices.size();
+    return i - aVertices.begin();
+  }
+
+  typedef std::map<std::string, ModelPerturber*> RegistryType;
+
+  // Kept in a function, so the registry is there for the perturbers below
+  // however their constructors are ordered.
+  static RegistryType&
+  registry()
+  {
+    static RegistryType sRegistry;
+    return sRegistry;
+  }
+
+  const char* mName;
+};
+
+class LabelSwitchingPerturber
+  : public ModelPerturber
+{
+public:
+  LabelSwitchingPerturber()
+    : ModelPerturber("label_switching"), mProb(1.0)
+  {
+  }
+
+  void
+  setParams(const std::string& aParams)
+  {
+    mProb = strtod(aParams.c_str(), NULL);
+  }
+
+  void
+  resetParams()
+  {
+    mProb = 1.0;
+  }
+
+  ModelPerturber*
+  clone() const
+  {
+    return new LabelSwitchingPerturber(*this);
+  }
+
+  bool
+  perturb(const NetworkModel& aModel, NetworkModel& aResult,
+          boost::mt19937& aRng, std::string& aError)
+  {
+    std::list<std::string> allNames;
+    std::vector<std::pair<uint32_t, uint32_t> > allNumbers;
+
+    for (uint32_t v = 0; v < aModel.vertexCount(); v++)
+    {
+      boost::uniform_real<double> ur;
+      // Include it in the shuffle pool with probability mProb.
+      if (ur(aRng) < mProb)
+      {
+        allNames.push_back(aModel.vertexName(v));
+        uint32_t rv(aRng());
+        allNumbers.push_back(std::pair<uint32_t, uint32_t>(aModel.vertexId(v), rv));
+      }
+      else
+        aResult.addVertex(aModel.vertexId(v), aModel.vertexName(v));
+    }
+
+    // Now scramble allNumbers...
+    std::sort(
+              allNumbers.begin(), allNumbers.end(),
+              boost::lambda::bind<uint32_t>(&std::pair<uint32_t, uint32_t>::second, boost::lambda::_1) <
+              boost::lambda::bind<uint32_t>(&std::pair<uint32_t, uint32_t>::second, boost::lambda::_2)
+             );
+
+    // Add the vertices with their new names...
+    std::list<std::string>::iterator i;
+    std::vector<std::pair<uint32_t, uint32_t> >::iterator j;
+    for (i = allNames.begin(), j = allNumbers.begin(); i != allNames.end();
+         i++, j++)
+      aResult.addVertex((*j).first, *i);
+
+    copyEdges(aModel, aResult);
+    aResult.setComments(aModel.comments());
+    return true;
+  }
+
+  const char* getParameterHelp()
+  {
+    return "Use --params=<probability> to specify the probability a genes / label is "
+      "included in the pool to be scrambled.";
+  }
+  
+private:
+  double mProb;
+};
+static LabelSwitchingPerturber klsp;
+
+class EdgeDeletingPerturber
+  : public ModelPerturber
+{
+public:
+  EdgeDeletingPerturber()
+    : ModelPerturber("edge_deleting"), mProbDeletion(0.5)
+  {
+  }
+
+  void
+  setParams(const std::string& aParams)
+  {
+    mProbDeletion = strtod(aParams.c_str(), NULL);
+  }
+
+  void
+  resetParams()
+  {
+    mProbDeletion = 0.5;
+  }
+
+  ModelPerturber*
+  clone() const
+  {
+    return new EdgeDeletingPerturber(*this);
+  }
+
+  const char* getParameterHelp()
+  {
+    return "Use --params=<probDeletion> to set the probability a given edge is deleted.";
+  }
+
+  bool
+  perturb(const NetworkModel& aModel, NetworkModel& aResult,
+          boost::mt19937& aRng, std::string& aError)
+  {
+    copyVertices(aModel, aResult);
+
+    boost::uniform_real<double> ur;
+
+    std::vector<uint32_t> regs;
+    for (uint32_t t = 0; t < aModel.targetCount(); t++)
+    {
+      regs.clear();
+      for (const uint32_t* r = aModel.regulatorsBegin(t);
+           r != aModel.regulatorsEnd(t); r++)
+      {
+        if (ur(aRng) <= mProbDeletion)
+          continue;
+        regs.push_back(*r);
+      }
+
+      if (regs.empty())
+        continue;
+
+      aResult.addTarget(aModel.target(t));
+      for (uint32_t r = 0; r < regs.size(); r++)
+        aResult.addRegulator(regs[r]);
+    }
+    aResult.setComments(aModel.comments());
+    return true;
+  }
+
+private:
+  double mProbDeletion;
+};
+static EdgeDeletingPerturber kedp;
+
+class EdgeInsertingPerturber
+  : public ModelPerturber
+{
+public:
+  EdgeInsertingPerturber()
+    : ModelPerturber("edge_inserting"), mPercentInserted(0.5)
+  {
+  }
+
+  void
+  setParams(const std::string& aParams)
+  {
+    mPercentInserted = strtod(aParams.c_str(), NULL);
+  }
+
+  void
+  resetParams()
+  {
+    mPercentInserted = 0.5;
+  }
+
+  ModelPerturber*
+  clone() const
+  {
+    return new EdgeInsertingPerturber(*this);
+  }
+
+  const char* getParameterHelp()
+  {
+    return "Use --params=<percentInsertion> to set the number of edges to insert as a "
+      "percentage of the current edge count.";
+  }
+
+  // The result is sorted by target and regulator, and has no comments.
+  bool
+  perturb(const NetworkModel& aModel, NetworkModel& aResult,
+          boost::mt19937& aRng, std::string& aError)
+  {
+    copyVertices(aModel, aResult);
+
+    std::vector<uint32_t> vertices;
+    collectVertices(aModel, vertices);
+
+    std::vector<uint64_t> edges;
+    collectEdges(aModel, edges);
+
+    if (mPercentInserted < 0)
+    {
+      aError = "The percentage of edges to insert cannot be negative.";
+      return false;
+    }
+    uint64_t numAdditions = edges.size() * mPercentInserted * 0.01;
+    if (!addRandomEdges(vertices, edges, numAdditions, aRng, aError))
+      return false;
+
+    addEdges(edges, aResult);
+    return true;
+  }
+
+private:
+  double mPercentInserted;
+};
+static EdgeInsertingPerturber keip;
+
+class EdgeReplacingPerturber
+  : public ModelPerturber
+{
+public:
+  EdgeReplacingPerturber()
+    : ModelPerturber("edge_replacing"), mProbReplaced(0.5)
+  {
+  }
+
+  void
+  setParams(const std::string& aParams)
+  {
+    mProbReplaced = strtod(aParams.c_str(), NULL);
+  }
+
+  void
+  resetParams()
+  {
+    mProbReplaced = 0.5;
+  }
+
+  ModelPerturber*
+  clone() const
+  {
+    return new EdgeReplacingPerturber(*this);
+  }
+
+  const char* getParameterHelp()
+  {
+    return "Use --params=<probReplaced> to set the probability a given edge "
+      "gets replaced in the model.";
+  }
+
+  // The result is sorted by target and regulator, and has no comments.
+  bool
+  perturb(const NetworkModel& aModel, NetworkModel& aResult,
+          boost::mt19937& aRng, std::string& aError)
+  {
+    copyVertices(aModel, aResult);
+
+    std::vector<uint32_t> vertices;
+    collectVertices(aModel, vertices);
+
+    std::vector<uint64_t> edges;
+    collectEdges(aModel, edges);
+
+    // Each edge picked for replacement gets a new one alongside it, between
+    // vertices neither the model nor the edges added so far connect; the
+    // picked edge itself stays.
+    boost::uniform_real<double> ur;
+    uint64_t replaced = 0;
+    for (uint32_t i = 0; i < edges.size(); i++)
+      if (ur(aRng) < mProbReplaced)
+        replaced++;
+    if (!addRandomEdges(vertices, edges, replaced, aRng, aError))
+      return false;
+
+    addEdges(edges, aResult);
+    return true;
+  }
+
+private:
+  double mProbReplaced;
+};
+static EdgeReplacingPerturber kerp;
+
+class DegreePreservingPerturber
+  : public ModelPerturber
+{
+public:
+  DegreePreservingPerturber()
+    : ModelPerturber("degree_preserving"), mSwapsPerEdge(10.0)
+  {
+  }
+
+  void
+  setParams(const std::string& aParams)
+  {
+    mSwapsPerEdge = strtod(aParams.c_str(), NULL);
+  }
+
+  void
+  resetParams()
+  {
+    mSwapsPerEdge = 10.0;
+  }
+
+  ModelPerturber*
+  clone() const
+  {
+    return new DegreePreservingPerturber(*this);
+  }
+
+  const char* getParameterHelp()
+  {
+    return "Use --params=<swapsPerEdge> to set the number of double-edge swaps "
+      "attempted for each edge (default 10). Every gene keeps its number of "
+      "regulators and of targets.";
+  }
+
+  // The result is sorted by target and regulator.
+  bool
+  perturb(const NetworkModel& aModel, NetworkModel& aResult,
+          boost::mt19937& aRng, std::string& aError)
+  {
+    if (mSwapsPerEdge < 0)
+    {
+      aError = "The number of swaps per edge cannot be negative.";
+      return false;
+    }
+
+    copyVertices(aModel, aResult);
+
+    std::vector<uint64_t> edges;
+    collectEdges(aModel, edges);
+
+    EdgeSwapper swapper(edges);
+    swapper.swap(static_cast<uint64_t>(edges.size() * mSwapsPerEdge), aRng);
+    edges = swapper.edges();
+    radixSort(edges);
+
+    addEdges(edges, aResult);
+    aResult.setComments(aModel.comments());
+    return true;
+  }
+
+private:
+  double mSwapsPerEdge;
+};
+static DegreePreservingPerturber kdpp;
+
+#endif // TFNET_MODEL_PERTURBERS_HPP
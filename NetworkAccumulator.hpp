@@ -0,0 +1,114 @@
+#ifndef TFNET_NETWORK_ACCUMULATOR_HPP
+#define TFNET_NETWORK_ACCUMULATOR_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "NetworkModel.hpp"
+#include "PackedEdges.hpp"
+
+// The edges of a network as the builder finds them, with a count for each
+// vertex of how many times it has been regulated. Regulators are counted as
+// 1000, so they always have enough regulations to be kept.
+class NetworkAccumulator
+{
+public:
+  static const uint32_t kMaxRegulated = 3500;
+
+  NetworkAccumulator()
+    : nRegulated(0)
+  {
+  }
+
+  bool processEdge(uint32_t aTargetHGNC, uint32_t sourceHGNC)
+  {
+    // We now have a source and target HGNC id... Just add them to the
+    // edge set for now, and also mark the source and target as used.
+
+    std::map<uint32_t, uint32_t>::iterator j;
+    if ((j = usedHGNCIds.find(aTargetHGNC)) != usedHGNCIds.end())
+      (*j).second++;
+    else
+    {
+      if (nRegulated++ > kMaxRegulated)
+        return false;
+      usedHGNCIds.insert(std::pair<uint32_t, uint32_t>(aTargetHGNC, 1));
+    }
+
+    // The edge set for the source is set to 1000, which is a special to
+    // guarantee it is included.
+    usedHGNCIds[sourceHGNC] = 1000;
+
+    edges.add(aTargetHGNC, sourceHGNC);
+
+    return true;
+  }
+
+  uint32_t
+  usage(uint32_t aHGNC) const
+  {
+    std::map<uint32_t, uint32_t>::const_iterator i(usedHGNCIds.find(aHGNC));
+    return (i == usedHGNCIds.end()) ? 0 : (*i).second;
+  }
+
+  // Adds the vertices used at least aMinRegs times, and the edges between
+  // them, to aModel, naming the vertices from aNames.
+  void
+  buildModel(uint32_t aMinRegs, const std::map<uint32_t, std::string>& aNames,
+             NetworkModel& aModel)
+  {
+    static const std::string kNoName;
+    for
+    (
+     std::map<uint32_t, uint32_t>::const_iterator i = usedHGNCIds.begin();
+     i != usedHGNCIds.end();
+     i++
+    )
+      if ((*i).second >= aMinRegs)
+      {
+        std::map<uint32_t, std::string>::const_iterator name =
+          aNames.find((*i).first);
+        aModel.addVertex((*i).first,
+                         name == aNames.end() ? kNoName : (*name).second);
+      }
+
+    // The edges are sorted by target, so each target's regulators are a
+    // contiguous run, which becomes one CSR row as it stands.
+    const std::vector<uint64_t>& sorted(edges.edges());
+    std::vector<uint64_t>::const_iterator j = sorted.begin();
+    for
+    (
+     std::map<uint32_t, uint32_t>::const_iterator i = usedHGNCIds.begin();
+     i != usedHGNCIds.end();
+     i++
+    )
+    {
+      while (j != sorted.end() && edgeTarget(*j) < (*i).first)
+        j++;
+      std::vector<uint64_t>::const_iterator first = j;
+      while (j != sorted.end() && edgeTarget(*j) == (*i).first)
+        j++;
+
+      if ((*i).second < aMinRegs)
+        continue;
+
+      std::vector<uint64_t>::const_iterator k = first;
+      while (k != j && usage(edgeSource(*k)) < aMinRegs)
+        k++;
+      if (k == j)
+        continue;
+
+      aModel.addTarget((*i).first);
+      for (; k != j; k++)
+        if (usage(edgeSource(*k)) >= aMinRegs)
+          aModel.addRegulator(edgeSource(*k));
+    }
+  }
+
+  uint32_t nRegulated;
+  std::map<uint32_t, uint32_t> usedHGNCIds;
+  EdgeAccumulator edges;
+};
+
+#endif // TFNET_NETWORK_ACCUMULATOR_HPP
@@ -0,0 +1,530 @@
+#ifndef TFNET_NETWORK_MODEL_HPP
+#define TFNET_NETWORK_MODEL_HPP
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/filesystem.hpp>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+
+// The binary network format, version 1. All integers are in native byte
+// order (checked with byteOrder) and every section starts on an 8 byte
+// boundary, so a mapped file can be used in place:
+//   BinaryNetworkHeader
+//   BinaryNetworkVertex vertices[vertexCount]
+//   uint32_t targets[targetCount]         HGNC IDs of the regulated genes
+//   uint32_t offsets[targetCount + 1]     CSR offsets into regulators
+//   uint32_t regulators[edgeCount]        HGNC IDs of the regulators
+//   char pool[poolSize]                   NUL terminated vertex names,
+//                                         followed by the comment lines
+struct BinaryNetworkHeader
+{
+  char magic[8];
+  uint32_t version, byteOrder;
+  uint32_t vertexCount, targetCount, edgeCount, padding;
+  uint64_t verticesOffset, targetsOffset, offsetsOffset, regulatorsOffset;
+  uint64_t poolOffset, poolSize, commentsOffset, commentsSize;
+};
+
+struct BinaryNetworkVertex
+{
+  uint32_t hgncId, nameOffset;
+};
+
+// A network of vertices and, for each regulated gene, its regulators. It
+// can be read from either the text or the binary format (a binary file is
+// mapped and used without copying), or built up in memory, and written out
+// in either format.
+class NetworkModel
+  : public boost::noncopyable
+{
+public:
+  static const uint32_t kVersion = 1, kByteOrder = 0x01020304;
+
+  NetworkModel()
+  {
+    clear();
+  }
+
+  bool
+  load(const std::string& aPath, std::ostream& aErrors)
+  {
+    clear();
+
+    char fileMagic[8] = "";
+    {
+      std::ifstream in(aPath.c_str(), std::ios::binary);
+      if (!in.good())
+      {
+        aErrors << "Cannot open " << aPath << std::endl;
+        return false;
+      }
+      in.read(fileMagic, sizeof(fileMagic));
+    }
+
+    if (!memcmp(fileMagic, magic(), sizeof(fileMagic)))
+      return loadBinary(aPath, aErrors);
+
+    return loadText(aPath, aErrors);
+  }
+
+  uint32_t
+  vertexCount() const
+  {
+    return mVertexCount;
+  }
+
+  uint32_t
+  vertexId(uint32_t aIndex) const
+  {
+    return mVertices[aIndex].hgncId;
+  }
+
+  const char*
+  vertexName(uint32_t aIndex) const
+  {
+    return mNames + mVertices[aIndex].nameOffset;
+  }
+
+  uint32_t
+  targetCount() const
+  {
+    return mTargetCount;
+  }
+
+  uint32_t
+  target(uint32_t aIndex) const
+  {
+    return mTargets[aIndex];
+  }
+
+  const uint32_t*
+  regulatorsBegin(uint32_t aIndex) const
+  {
+    return mRegulators + mOffsets[aIndex];
+  }
+
+  const uint32_t*
+  regulatorsEnd(uint32_t aIndex) const
+  {
+    return mRegulators + mOffsets[aIndex + 1];
+  }
+
+  uint32_t
+  edgeCount() const
+  {
+    return mOffsets[mTargetCount];
+  }
+
+  // The comment lines that followed the edges, newlines included.
+  std::string
+  comments() const
+  {
+    return std::string(mComments, mCommentsSize);
+  }
+
+  // Empties the model, so it can be built up again.
+  void
+  clear()
+  {
+    if (mMapping.is_open())
+      mMapping.close();
+    mOwnedVertices.clear();
+    mOwnedTargets.clear();
+    mOwnedOffsets.assign(1, 0);
+    mOwnedRegulators.clear();
+    mOwnedNames.clear();
+    mOwnedComments.clear();
+    attachOwned();
+  }
+
+  // Building a model in memory: vertices, then each target followed by its
+  // regulators, then the comments.
+  void
+  addVertex(uint32_t aHGNC, const std::string& aName)
+  {
+    BinaryNetworkVertex v = { aHGNC, static_cast<uint32_t>(mOwnedNames.size()) };
+    mOwnedVertices.push_back(v);
+    mOwnedNames += aName;
+    mOwnedNames += '\0';
+    attachOwned();
+  }
+
+  void
+  addTarget(uint32_t aHGNC)
+  {
+    mOwnedTargets.push_back(aHGNC);
+    mOwnedOffsets.push_back(mOwnedRegulators.size());
+    attachOwned();
+  }
+
+  void
+  addRegulator(uint32_t aHGNC)
+  {
+    mOwnedRegulators.push_back(aHGNC);
+    mOwnedOffsets.back() = mOwnedRegulators.size();
+    attachOwned();
+  }
+
+  void
+  setComments(const std::string& aComments)
+  {
+    mOwnedComments = aComments;
+    attachOwned();
+  }
+
+  void
+  writeVerticesText(std::ostream& aOut) const
+  {
+    aOut << "VERTICES" << std::endl;
+    for (uint32_t i = 0; i < mVertexCount; i++)
+      aOut << "VERTEX " << vertexId(i) << " " << vertexName(i) << std::endl;
+    aOut << "ENDVERTICES" << std::endl;
+  }
+
+  void
+  writeEdgesText(std::ostream& aOut) const
+  {
+    for (uint32_t i = 0; i < mTargetCount; i++)
+    {
+      aOut << "EDGES " << mTargets[i] << " (";
+      for (const uint32_t* r = regulatorsBegin(i); r != regulatorsEnd(i); r++)
+        aOut << *r << " ";
+      aOut << ")" << std::endl;
+    }
+  }
+
+  void
+  writeText(std::ostream& aOut) const
+  {
+    writeVerticesText(aOut);
+    writeEdgesText(aOut);
+    aOut.write(mComments, mCommentsSize);
+  }
+
+  void
+  writeBinary(std::ostream& aOut) const
+  {
+    BinaryNetworkHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, magic(), sizeof(header.magic));
+    header.version = kVersion;
+    header.byteOrder = kByteOrder;
+    header.vertexCount = mVertexCount;
+    header.targetCount = mTargetCount;
+    header.edgeCount = edgeCount();
+
+    // Names first, then the comments, all in one pool.
+    std::string pool;
+    std::vector<BinaryNetworkVertex> vertices(mVertexCount);
+    for (uint32_t i = 0; i < mVertexCount; i++)
+    {
+      vertices[i].hgncId = vertexId(i);
+      vertices[i].nameOffset = pool.size();
+      pool += vertexName(i);
+      pool += '\0';
+    }
+    header.commentsOffset = pool.size();
+    header.commentsSize = mCommentsSize;
+    pool.append(mComments, mCommentsSize);
+    pool += '\0';
+
+    uint64_t pos = align(sizeof(header));
+    header.verticesOffset = pos;
+    pos = align(pos + mVertexCount * sizeof(BinaryNetworkVertex));
+    header.targetsOffset = pos;
+    pos = align(pos + mTargetCount * sizeof(uint32_t));
+    header.offsetsOffset = pos;
+    pos = align(pos + (mTargetCount + 1) * sizeof(uint32_t));
+    header.regulatorsOffset = pos;
+    pos = align(pos + edgeCount() * sizeof(uint32_t));
+    header.poolOffset = pos;
+    header.poolSize = pool.size();
+
+    uint64_t written = 0;
+    writeSection(aOut, written, 0, &header, sizeof(header));
+    writeSection(aOut, written, header.verticesOffset,
+                 mVertexCount ? &vertices[0] : NULL,
+                 mVertexCount * sizeof(BinaryNetworkVertex));
+    writeSection(aOut, written, header.targetsOffset, mTargets,
+                 mTargetCount * sizeof(uint32_t));
+    writeSection(aOut, written, header.offsetsOffset, mOffsets,
+                 (mTargetCount + 1) * sizeof(uint32_t));
+    writeSection(aOut, written, header.regulatorsOffset, mRegulators,
+                 edgeCount() * sizeof(uint32_t));
+    writeSection(aOut, written, header.poolOffset, pool.data(), pool.size());
+  }
+
+private:
+  static const char*
+  magic()
+  {
+    return "TFNETBIN";
+  }
+
+  static uint64_t
+  align(uint64_t aOffset)
+  {
+    return (aOffset + 7) & ~static_cast<uint64_t>(7);
+  }
+
+  static void
+  writeSection(std::ostream& aOut, uint64_t& aWritten, uint64_t aOffset,
+               const void* aData, uint64_t aSize)
+  {
+    static const char kZeroes[8] = { 0 };
+    aOut.write(kZeroes, aOffset - aWritten);
+    if (aSize)
+      aOut.write(static_cast<const char*>(aData), aSize);
+    aWritten = aOffset + aSize;
+  }
+
+  // Points the accessors at the in-memory copies.
+  void
+  attachOwned()
+  {
+    mVertexCount = mOwnedVertices.size();
+    mVertices = mVertexCount ? &mOwnedVertices[0] : NULL;
+    mTargetCount = mOwnedTargets.size();
+    mTargets = mTargetCount ? &mOwnedTargets[0] : NULL;
+    mOffsets = &mOwnedOffsets[0];
+    mRegulators = mOwnedRegulators.empty() ? NULL : &mOwnedRegulators[0];
+    mNames = mOwnedNames.data();
+    mComments = mOwnedComments.data();
+    mCommentsSize = mOwnedComments.size();
+  }
+
+  // Reads the text format out of a mapping of the file. Lines are taken
+  // exactly as these patterns would take them:
+  //   "^VERTEX ([0-9]+) (.*)$"
+  //   "^EDGES ([0-9]+) \\(([^\\)]+)\\)$"
+  // with the regulators being the runs between spaces and tabs, and every
+  // other line after ENDVERTICES kept as a comment.
+  bool
+  loadText(const std::string& aPath, std::ostream& aErrors)
+  {
+    boost::iostreams::mapped_file_source file;
+    const char* p = NULL, * end = NULL;
+    boost::system::error_code ec;
+    if (boost::filesystem::file_size(aPath, ec) != 0 && !ec)
+    {
+      try
+      {
+        file.open(aPath);
+      }
+      catch (const std::exception& e)
+      {
+        aErrors << "Cannot map " << aPath << ": " << e.what() << std::endl;
+        return false;
+      }
+      p = file.data();
+      end = p + file.size();
+    }
+
+    const char* line, * eol;
+    if (!nextLine(p, end, line, eol) || !isLine(line, eol, "VERTICES", 8))
+    {
+      aErrors << "Expected VERTICES line" << std::endl;
+      return false;
+    }
+
+    while (nextLine(p, end, line, eol))
+    {
+      if (isLine(line, eol, "ENDVERTICES", 11))
+        break;
+
+      const char* digits = line + 7, * digitsEnd = digits;
+      if (eol - line < 7 || memcmp(line, "VERTEX ", 7))
+        continue;
+      while (digitsEnd != eol && *digitsEnd >= '0' && *digitsEnd <= '9')
+        digitsEnd++;
+      if (digitsEnd == digits || digitsEnd == eol || *digitsEnd != ' ')
+        continue;
+
+      BinaryNetworkVertex v =
+        { parseId(digits, digitsEnd),
+          static_cast<uint32_t>(mOwnedNames.size()) };
+      mOwnedVertices.push_back(v);
+      mOwnedNames.append(digitsEnd + 1, eol);
+      mOwnedNames += '\0';
+    }
+
+    while (nextLine(p, end, line, eol))
+    {
+      const char* digits = line + 6, * digitsEnd = digits;
+      bool isEdges = eol - line >= 6 && !memcmp(line, "EDGES ", 6);
+      if (isEdges)
+      {
+        while (digitsEnd != eol && *digitsEnd >= '0' && *digitsEnd <= '9')
+          digitsEnd++;
+        // The list runs to the first ')', which has to end the line.
+        const char* close = NULL;
+        if (digitsEnd != digits && eol - digitsEnd >= 4 &&
+            digitsEnd[0] == ' ' && digitsEnd[1] == '(')
+          close = static_cast<const char*>
+            (memchr(digitsEnd + 2, ')', eol - digitsEnd - 2));
+        isEdges = close != NULL && close == eol - 1 && close != digitsEnd + 2;
+      }
+
+      if (!isEdges)
+      {
+        mOwnedComments.append(line, eol);
+        mOwnedComments += '\n';
+        continue;
+      }
+
+      mOwnedTargets.push_back(parseId(digits, digitsEnd));
+      const char* r = digitsEnd + 2, * listEnd = eol - 1;
+      while (r != listEnd)
+      {
+        if (*r == ' ' || *r == '\t')
+        {
+          r++;
+          continue;
+        }
+        const char* regulator = r;
+        while (r != listEnd && *r != ' ' && *r != '\t')
+          r++;
+        mOwnedRegulators.push_back(parseId(regulator, r));
+      }
+      mOwnedOffsets.push_back(mOwnedRegulators.size());
+    }
+
+    attachOwned();
+    return true;
+  }
+
+  static bool
+  nextLine(const char*& aPos, const char* aEnd, const char*& aLine,
+           const char*& aLineEnd)
+  {
+    if (aPos >= aEnd)
+      return false;
+    aLine = aPos;
+    aLineEnd = static_cast<const char*>(memchr(aPos, '\n', aEnd - aPos));
+    if (aLineEnd == NULL)
+      aLineEnd = aEnd;
+    aPos = aLineEnd + 1;
+    return true;
+  }
+
+  static bool
+  isLine(const char* aLine, const char* aLineEnd, const char* aText,
+         size_t aLength)
+  {
+    return static_cast<size_t>(aLineEnd - aLine) == aLength &&
+      !memcmp(aLine, aText, aLength);
+  }
+
+  // strtoul() on an ID, which is almost always just a few digits.
+  static uint32_t
+  parseId(const char* aBegin, const char* aEnd)
+  {
+    uint32_t v = 0;
+    const char* p = aBegin;
+    while (p != aEnd && p - aBegin < 9 && *p >= '0' && *p <= '9')
+      v = v * 10 + (*p++ - '0');
+    if (p == aBegin || p != aEnd)
+      v = strtoul(std::string(aBegin, aEnd).c_str(), NULL, 10);
+    return v;
+  }
+
+  bool
+  loadBinary(const std::string& aPath, std::ostream& aErrors)
+  {
+    try
+    {
+      mMapping.open(aPath);
+    }
+    catch (const std::exception& e)
+    {
+      aErrors << "Cannot map " << aPath << ": " << e.what() << std::endl;
+      return false;
+    }
+
+    const char* base = mMapping.data();
+    uint64_t size = mMapping.size();
+    BinaryNetworkHeader header;
+    if (size < sizeof(header))
+      return corrupt(aPath, aErrors);
+    memcpy(&header, base, sizeof(header));
+
+    if (header.version != kVersion || header.byteOrder != kByteOrder)
+    {
+      aErrors << aPath << " is a binary network in an unsupported version "
+              << "or byte order." << std::endl;
+      mMapping.close();
+      return false;
+    }
+
+    if (!inBounds(size, header.verticesOffset,
+                  header.vertexCount * sizeof(BinaryNetworkVertex)) ||
+        !inBounds(size, header.targetsOffset,
+                  header.targetCount * sizeof(uint32_t)) ||
+        !inBounds(size, header.offsetsOffset,
+                  (header.targetCount + 1ULL) * sizeof(uint32_t)) ||
+        !inBounds(size, header.regulatorsOffset,
+                  header.edgeCount * sizeof(uint32_t)) ||
+        !inBounds(size, header.poolOffset, header.poolSize) ||
+        header.poolSize == 0 || base[header.poolOffset + header.poolSize - 1] ||
+        header.commentsOffset > header.poolSize ||
+        header.commentsSize > header.poolSize - header.commentsOffset)
+      return corrupt(aPath, aErrors);
+
+    mVertexCount = header.vertexCount;
+    mVertices = reinterpret_cast<const BinaryNetworkVertex*>
+      (base + header.verticesOffset);
+    mTargetCount = header.targetCount;
+    mTargets = reinterpret_cast<const uint32_t*>(base + header.targetsOffset);
+    mOffsets = reinterpret_cast<const uint32_t*>(base + header.offsetsOffset);
+    mRegulators = reinterpret_cast<const uint32_t*>
+      (base + header.regulatorsOffset);
+    mNames = base + header.poolOffset;
+    mComments = mNames + header.commentsOffset;
+    mCommentsSize = header.commentsSize;
+
+    for (uint32_t i = 0; i < mVertexCount; i++)
+      if (mVertices[i].nameOffset >= header.poolSize)
+        return corrupt(aPath, aErrors);
+    for (uint32_t i = 0; i < mTargetCount; i++)
+      if (mOffsets[i] > mOffsets[i + 1])
+        return corrupt(aPath, aErrors);
+    if (mOffsets[0] != 0 || mOffsets[mTargetCount] != header.edgeCount)
+      return corrupt(aPath, aErrors);
+
+    return true;
+  }
+
+  static bool
+  inBounds(uint64_t aSize, uint64_t aOffset, uint64_t aLength)
+  {
+    return aOffset <= aSize && aLength <= aSize - aOffset;
+  }
+
+  bool
+  corrupt(const std::string& aPath, std::ostream& aErrors)
+  {
+    aErrors << aPath << " is not a valid binary network." << std::endl;
+    clear();
+    return false;
+  }
+
+  boost::iostreams::mapped_file_source mMapping;
+
+  uint32_t mVertexCount, mTargetCount;
+  const BinaryNetworkVertex* mVertices;
+  const uint32_t* mTargets, * mOffsets, * mRegulators;
+  const char* mNames, * mComments;
+  uint64_t mCommentsSize;
+
+  std::vector<BinaryNetworkVertex> mOwnedVertices;
+  std::vector<uint32_t> mOwnedTargets, mOwnedOffsets, mOwnedRegulators;
+  std::string mOwnedNames, mOwnedComments;
+};
+
+#endif // TFNET_NETWORK_MODEL_HPP
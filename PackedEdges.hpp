@@ -0,0 +1,246 @@
+#ifndef TFNET_PACKED_EDGES_HPP
+#define TFNET_PACKED_EDGES_HPP
+
+#include <vector>
+#include <algorithm>
+#include <stdint.h>
+
+// Edges are packed into 64 bits with the target (regulated gene) in the high
+// half and the source (regulator) in the low half, so sorting the keys
+// groups the edges by target with the sources in ascending order, which is
+// the CSR order the network is written out in.
+inline uint64_t
+packEdge(uint32_t aTarget, uint32_t aSource)
+{
+  return (static_cast<uint64_t>(aTarget) << 32) | aSource;
+}
+
+inline uint32_t
+edgeTarget(uint64_t aEdge)
+{
+  return static_cast<uint32_t>(aEdge >> 32);
+}
+
+inline uint32_t
+edgeSource(uint64_t aEdge)
+{
+  return static_cast<uint32_t>(aEdge);
+}
+
+// LSD radix sort with 16 bit digits. A pass is skipped when every key has
+// the same digit, which for HGNC IDs (all below 2^16) leaves two passes.
+inline void
+radixSort(std::vector<uint64_t>& aKeys)
+{
+  static const uint32_t kDigits = 4, kRadix = 1 << 16;
+
+  std::vector<uint32_t> counts(kDigits * kRadix, 0);
+  for
+  (
+   std::vector<uint64_t>::const_iterator i = aKeys.begin();
+   i != aKeys.end();
+   i++
+  )
+    for (uint32_t d = 0; d < kDigits; d++)
+      counts[d * kRadix + (((*i) >> (16 * d)) & (kRadix - 1))]++;
+
+  std::vector<uint64_t> buffer(aKeys.size());
+  for (uint32_t d = 0; d < kDigits; d++)
+  {
+    uint32_t* count = &counts[d * kRadix];
+    if (!aKeys.empty() &&
+        count[(aKeys[0] >> (16 * d)) & (kRadix - 1)] == aKeys.size())
+      continue;
+
+    uint32_t total = 0;
+    for (uint32_t b = 0; b < kRadix; b++)
+    {
+      uint32_t c = count[b];
+      count[b] = total;
+      total += c;
+    }
+
+    for
+    (
+     std::vector<uint64_t>::const_iterator i = aKeys.begin();
+     i != aKeys.end();
+     i++
+    )
+      buffer[count[((*i) >> (16 * d)) & (kRadix - 1)]++] = *i;
+
+    aKeys.swap(buffer);
+  }
+}
+
+// Collects edges in an append-only vector, which is radix sorted and
+// deduplicated whenever it has doubled since the last time, so it never
+// grows much beyond twice the number of distinct edges.
+class EdgeAccumulator
+{
+public:
+  EdgeAccumulator()
+    : mUnique(0), mCompactAt(kMinCompact)
+  {
+  }
+
+  void
+  add(uint32_t aTarget, uint32_t aSource)
+  {
+    mEdges.push_back(packEdge(aTarget, aSource));
+    if (mEdges.size() >= mCompactAt)
+    {
+      compact();
+      mCompactAt = mEdges.size() * 2;
+      if (mCompactAt < kMinCompact)
+        mCompactAt = kMinCompact;
+    }
+  }
+
+  // The distinct edges, sorted by target then source.
+  const std::vector<uint64_t>&
+  edges()
+  {
+    if (mUnique != mEdges.size())
+      compact();
+    return mEdges;
+  }
+
+private:
+  static const size_t kMinCompact = 1 << 20;
+
+  void
+  compact()
+  {
+    radixSort(mEdges);
+    mEdges.erase(std::unique(mEdges.begin(), mEdges.end()), mEdges.end());
+    mUnique = mEdges.size();
+  }
+
+  std::vector<uint64_t> mEdges;
+  size_t mUnique, mCompactAt;
+};
+
+// A set of packed edges (or any other 64 bit keys but ~0) in an open
+// addressed table with linear probing, for membership tests in constant
+// time. The table is kept at most half full.
+class PackedEdgeSet
+{
+public:
+  PackedEdgeSet(size_t aExpected = 0)
+  {
+    uint32_t bits = 4;
+    while ((static_cast<size_t>(1) << bits) < aExpected * 2)
+      bits++;
+    reset(bits);
+  }
+
+  // Returns false if the key was already there.
+  bool
+  insert(uint64_t aKey)
+  {
+    if ((mSize + 1) * 2 > mSlots.size())
+      grow();
+
+    size_t mask = mSlots.size() - 1;
+    for (size_t i = slot(aKey); ; i = (i + 1) & mask)
+    {
+      if (mSlots[i] == aKey)
+        return false;
+      if (mSlots[i] == kEmpty)
+      {
+        mSlots[i] = aKey;
+        mSize++;
+        return true;
+      }
+    }
+  }
+
+  // Returns false if the key was not there. Later keys in the same run are
+  // shifted back over the gap, so lookups never need tombstones.
+  bool
+  erase(uint64_t aKey)
+  {
+    size_t mask = mSlots.size() - 1;
+    size_t i = slot(aKey);
+    while (mSlots[i] != aKey)
+    {
+      if (mSlots[i] == kEmpty)
+        return false;
+      i = (i + 1) & mask;
+    }
+
+    for (size_t j = (i + 1) & mask; mSlots[j] != kEmpty; j = (j + 1) & mask)
+    {
+      // A key whose home slot is cyclically in (i, j] can stay where it is.
+      size_t home = slot(mSlots[j]);
+      if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+        continue;
+      mSlots[i] = mSlots[j];
+      i = j;
+    }
+    mSlots[i] = kEmpty;
+    mSize--;
+    return true;
+  }
+
+  bool
+  contains(uint64_t aKey) const
+  {
+    size_t mask = mSlots.size() - 1;
+    for (size_t i = slot(aKey); mSlots[i] != kEmpty; i = (i + 1) & mask)
+      if (mSlots[i] == aKey)
+        return true;
+    return false;
+  }
+
+  size_t
+  size() const
+  {
+    return mSize;
+  }
+
+  // Appends the keys, in no particular order.
+  void
+  keys(std::vector<uint64_t>& aKeys) const
+  {
+    for (size_t i = 0; i < mSlots.size(); i++)
+      if (mSlots[i] != kEmpty)
+        aKeys.push_back(mSlots[i]);
+  }
+
+private:
+  static const uint64_t kEmpty = ~static_cast<uint64_t>(0);
+
+  // Fibonacci hashing: the top bits of the key times 2^64 / phi.
+  size_t
+  slot(uint64_t aKey) const
+  {
+    return static_cast<size_t>((aKey * 0x9E3779B97F4A7C15ULL) >> (64 - mBits));
+  }
+
+  void
+  reset(uint32_t aBits)
+  {
+    uint64_t empty = kEmpty;
+    mBits = aBits;
+    mSlots.assign(static_cast<size_t>(1) << mBits, empty);
+    mSize = 0;
+  }
+
+  void
+  grow()
+  {
+    std::vector<uint64_t> old;
+    old.swap(mSlots);
+    reset(mBits + 1);
+    for (size_t i = 0; i < old.size(); i++)
+      if (old[i] != kEmpty)
+        insert(old[i]);
+  }
+
+  std::vector<uint64_t> mSlots;
+  size_t mSize;
+  uint32_t mBits;
+};
+
+#endif // TFNET_PACKED_EDGES_HPP
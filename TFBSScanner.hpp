@@ -0,0 +1,307 @@
+#ifndef TFNET_TFBS_SCANNER_HPP
+#define TFNET_TFBS_SCANNER_HPP
+
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/filesystem.hpp>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+#include <sys/mman.h>
+
+// Receives what a TFBSScanner finds, in file order. Probability() and
+// Factor() are reported for the /probability and /db_xref="TRANSFAC:..."
+// qualifiers of every feature, and TFBS() when a TFBS feature ends, just as
+// a GenBankSink would see them through Qualifier() and CloseFeature().
+class TFBSScanSink
+{
+public:
+  virtual ~TFBSScanSink() {}
+  virtual void Probability(double aProbability) = 0;
+  virtual void Factor(const char* aAccession, size_t aLength) = 0;
+  virtual void TFBS(bool aIsComplement, uint32_t aStart, uint32_t aEnd) = 0;
+};
+
+// Reads the feature table of a BaSeTraM output file straight out of a
+// mapping of it. It follows the GenBank parser's line rules (keywords,
+// features in column 5, qualifiers starting with '/', continuation lines
+// joined with a space) but only decodes the qualifiers the builder uses, and
+// parses numbers by hand, falling back to strtoul()/strtod() for anything
+// out of the ordinary so the values always come out the same.
+class TFBSScanner
+{
+public:
+  bool
+  scanFile(const std::string& aPath, TFBSScanSink& aSink, std::string& aError)
+  {
+    boost::system::error_code ec;
+    uintmax_t size = boost::filesystem::file_size(aPath, ec);
+    if (ec)
+    {
+      aError = "Cannot open " + aPath;
+      return false;
+    }
+    if (size == 0)
+      return true;
+
+    boost::iostreams::mapped_file_source file;
+    try
+    {
+      file.open(aPath);
+    }
+    catch (const std::exception& e)
+    {
+      aError = "Cannot map " + aPath + ": " + e.what();
+      return false;
+    }
+    ::madvise(const_cast<char*>(file.data()), file.size(), MADV_SEQUENTIAL);
+
+    scan(file.data(), file.data() + file.size(), aSink);
+    return true;
+  }
+
+  void
+  scan(const char* aBegin, const char* aEnd, TFBSScanSink& aSink)
+  {
+    mSink = &aSink;
+    mInFeatures = false;
+    mInFeature = false;
+    mQualifier = kNone;
+
+    const char* line = aBegin;
+    while (line < aEnd)
+    {
+      const char* eol =
+        static_cast<const char*>(memchr(line, '\n', aEnd - line));
+      if (eol == NULL)
+        eol = aEnd;
+      scanLine(line, eol);
+      line = eol + 1;
+    }
+
+    closeFeature();
+    mSink = NULL;
+  }
+
+  // strtoul() on a string of digits, without needing it NUL terminated.
+  static uint32_t
+  parseUInt(const char* aBegin, const char* aEnd, const char** aStop)
+  {
+    const char* p = aBegin;
+    uint32_t v = 0;
+    while (p != aEnd && p - aBegin < 9 && *p >= '0' && *p <= '9')
+      v = v * 10 + (*p++ - '0');
+
+    if (p == aBegin || (p != aEnd && ((*p >= '0' && *p <= '9'))))
+    {
+      std::string s(aBegin, aEnd);
+      char* stop;
+      v = strtoul(s.c_str(), &stop, 10);
+      p = aBegin + (stop - s.c_str());
+    }
+
+    *aStop = p;
+    return v;
+  }
+
+  // strtod() on a value. Up to 15 significant digits with no exponent are
+  // exact in a double, as is every power of ten up to 1E22, so the single
+  // division is correctly rounded just as strtod() is.
+  static double
+  parseDouble(const char* aBegin, const char* aEnd)
+  {
+    static const double kPow10[] =
+    {
+      1E0, 1E1, 1E2, 1E3, 1E4, 1E5, 1E6, 1E7, 1E8, 1E9, 1E10, 1E11,
+      1E12, 1E13, 1E14, 1E15, 1E16, 1E17, 1E18, 1E19, 1E20, 1E21, 1E22
+    };
+
+    const char* p = aBegin;
+    bool negative = false;
+    if (p != aEnd && (*p == '-' || *p == '+'))
+      negative = (*p++ == '-');
+
+    uint64_t mantissa = 0;
+    uint32_t digits = 0, decimals = 0;
+    bool point = false;
+    for (; p != aEnd; p++)
+    {
+      if (*p >= '0' && *p <= '9')
+      {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits++;
+        if (point)
+          decimals++;
+      }
+      else if (*p == '.' && !point)
+        point = true;
+      else
+        break;
+    }
+
+    bool simple = digits != 0 && digits <= 15 &&
+      (p == aEnd || !(((*p | 0x20) >= 'a' && (*p | 0x20) <= 'z') || *p == '.'));
+    if (!simple)
+    {
+      std::string s(aBegin, aEnd);
+      return strtod(s.c_str(), NULL);
+    }
+
+    double v = static_cast<double>(mantissa) / kPow10[decimals];
+    return negative ? -v : v;
+  }
+
+private:
+  enum Qualifier { kNone, kOther, kProbability, kDbXref };
+
+  static bool
+  startsWith(const char* aBegin, const char* aEnd, const char* aPrefix,
+             size_t aLength)
+  {
+    return static_cast<size_t>(aEnd - aBegin) >= aLength &&
+      !memcmp(aBegin, aPrefix, aLength);
+  }
+
+  void
+  scanLine(const char* aBegin, const char* aEnd)
+  {
+    if (aEnd - aBegin == 2 && aBegin[0] == '/' && aBegin[1] == '/')
+    {
+      closeFeature();
+      mInFeatures = false;
+      return;
+    }
+
+    if (aBegin != aEnd && *aBegin != ' ')
+    {
+      closeFeature();
+      const char* space =
+        static_cast<const char*>(memchr(aBegin, ' ', aEnd - aBegin));
+      mInFeatures = (space ? space : aEnd) - aBegin == 8 &&
+        !memcmp(aBegin, "FEATURES", 8);
+      return;
+    }
+
+    if (!mInFeatures)
+      return;
+
+    if (aEnd - aBegin > 5 && !memcmp(aBegin, "     ", 5) && aBegin[5] != ' ')
+    {
+      closeFeature();
+      const char* name = aBegin + 5;
+      const char* p = name;
+      while (p != aEnd && *p != ' ')
+        p++;
+      mIsTFBS = (p - name == 4 && !memcmp(name, "TFBS", 4));
+      while (p != aEnd && *p == ' ')
+        p++;
+      mLocation.assign(p, aEnd);
+      mInFeature = true;
+      mInLocation = true;
+      return;
+    }
+
+    const char* p = aBegin;
+    while (p != aEnd && *p == ' ')
+      p++;
+    if (p == aEnd)
+      return;
+
+    if (*p == '/')
+    {
+      mInLocation = false;
+      flushQualifier();
+
+      const char* name = p + 1;
+      const char* eq = static_cast<const char*>(memchr(name, '=', aEnd - name));
+      const char* nameEnd = eq ? eq : aEnd;
+      if (nameEnd - name == 11 && !memcmp(name, "probability", 11))
+        mQualifier = kProbability;
+      else if (nameEnd - name == 7 && !memcmp(name, "db_xref", 7))
+        mQualifier = kDbXref;
+      else
+        mQualifier = kOther;
+
+      mValueBegin = eq ? eq + 1 : aEnd;
+      mValueEnd = aEnd;
+      mJoined = false;
+    }
+    else if (mInFeature && mInLocation)
+      mLocation.append(p, aEnd);
+    else if (mQualifier != kNone)
+    {
+      if (!mJoined)
+      {
+        mValue.assign(mValueBegin, mValueEnd);
+        mJoined = true;
+      }
+      mValue += ' ';
+      mValue.append(p, aEnd);
+    }
+  }
+
+  void
+  flushQualifier()
+  {
+    Qualifier q = mQualifier;
+    mQualifier = kNone;
+    if (q == kNone || q == kOther)
+      return;
+
+    const char* b = mValueBegin, * e = mValueEnd;
+    if (mJoined)
+    {
+      b = mValue.data();
+      e = b + mValue.size();
+    }
+    if (e - b >= 2 && *b == '"' && e[-1] == '"')
+    {
+      b++;
+      e--;
+    }
+
+    if (q == kProbability)
+      mSink->Probability(parseDouble(b, e));
+    else if (startsWith(b, e, "TRANSFAC:", 9))
+    {
+      // The accession ends at the first NUL, as it would in a C string.
+      const char* nul = static_cast<const char*>(memchr(b + 9, '\0', e - b - 9));
+      mSink->Factor(b + 9, (nul ? nul : e) - (b + 9));
+    }
+  }
+
+  void
+  closeFeature()
+  {
+    flushQualifier();
+    if (!mInFeature)
+      return;
+    mInFeature = false;
+    if (!mIsTFBS)
+      return;
+
+    const char* p = mLocation.data(), * end = p + mLocation.size();
+    bool isComplement = startsWith(p, end, "complement(", 11);
+    if (isComplement)
+      p += 11;
+
+    const char* stop;
+    uint32_t start = parseUInt(p, end, &stop);
+    // The range end is taken from two characters on, whatever they are.
+    uint32_t rangeEnd = 0;
+    if (end - stop > 2)
+      rangeEnd = parseUInt(stop + 2, end, &stop);
+
+    mSink->TFBS(isComplement, start, rangeEnd);
+  }
+
+  TFBSScanSink* mSink;
+  bool mInFeatures, mInFeature, mInLocation, mIsTFBS;
+  std::string mLocation;
+  Qualifier mQualifier;
+  const char* mValueBegin, * mValueEnd;
+  bool mJoined;
+  std::string mValue;
+};
+
+#endif // TFNET_TFBS_SCANNER_HPP
@@ -0,0 +1,993 @@
+#include <boost/program_options.hpp>
+#include <boost/random.hpp>
+#include <boost/regex.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <new>
+#include <cstdlib>
+#include <time.h>
+#include "../parsegenbank/GenbankParser.hpp"
+#include "GeneWindows.hpp"
+#include "TFBSScanner.hpp"
+#include "MatrixScanner.hpp"
+#include "NetworkModel.hpp"
+#include "NetworkAccumulator.hpp"
+#include "HGNCResolver.hpp"
+#include "ModelPerturbers.hpp"
+#include "EdgeSwapper.hpp"
+#include <map>
+#include <set>
+
+namespace po = boost::program_options;
+
+// Every allocation made through operator new is counted, so that each
+// benchmark can report how many it makes.
+static uint64_t sAllocations = 0;
+
+#if __cplusplus >= 201103L
+#define TFNET_THROWS_BAD_ALLOC
+#define TFNET_THROWS_NOTHING noexcept
+#else
+#define TFNET_THROWS_BAD_ALLOC throw(std::bad_alloc)
+#define TFNET_THROWS_NOTHING throw()
+#endif
+
+// GCC warns of a mismatch if it can see malloc() or free() inlined where it
+// expects operator new or delete, so none of them is inlined.
+#ifdef __GNUC__
+#define TFNET_NOINLINE __attribute__((noinline))
+#else
+#define TFNET_NOINLINE
+#endif
+
+TFNET_NOINLINE void*
+operator new(size_t aSize) TFNET_THROWS_BAD_ALLOC
+{
+  sAllocations++;
+  void* p = malloc(aSize == 0 ? 1 : aSize);
+  if (p == NULL)
+    throw std::bad_alloc();
+  return p;
+}
+
+void*
+operator new[](size_t aSize) TFNET_THROWS_BAD_ALLOC
+{
+  return operator new(aSize);
+}
+
+TFNET_NOINLINE void
+operator delete(void* aPointer) TFNET_THROWS_NOTHING
+{
+  free(aPointer);
+}
+
+TFNET_NOINLINE void
+operator delete[](void* aPointer) TFNET_THROWS_NOTHING
+{
+  free(aPointer);
+}
+
+static double
+now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1E-9;
+}
+
+// The time taken by the quickest of a benchmark's repeats, and the number of
+// allocations it made.
+class Timing
+{
+public:
+  Timing()
+    : seconds(1E100), allocations(0), mStart(0.0), mAllocations(0)
+  {
+  }
+
+  void
+  start()
+  {
+    mAllocations = sAllocations;
+    mStart = now();
+  }
+
+  void
+  stop()
+  {
+    double elapsed = now() - mStart;
+    if (elapsed < seconds)
+    {
+      seconds = elapsed;
+      allocations = sAllocations - mAllocations;
+    }
+  }
+
+  double seconds;
+  uint64_t allocations;
+
+private:
+  double mStart;
+  uint64_t mAllocations;
+};
+
+// One benchmark's result, as printed and as written to the JSON file.
+struct BenchResult
+{
+  std::string name;
+  uint64_t ops, bytes, allocations;
+  double seconds;
+};
+
+static std::vector<BenchResult> sResults;
+
+// Reports aOps operations timed by aTiming, and the throughput if they
+// got through aBytes bytes of input or output.
+static void
+report(const std::string& aName, uint64_t aOps, const Timing& aTiming,
+       uint64_t aBytes = 0)
+{
+  BenchResult result;
+  result.name = aName;
+  result.ops = aOps;
+  result.bytes = aBytes;
+  result.allocations = aTiming.allocations;
+  result.seconds = aTiming.seconds;
+  sResults.push_back(result);
+
+  std::cout << aName << ": " << aOps << " ops, "
+            << (aTiming.seconds * 1E9 / aOps) << " ns/op, "
+            << (static_cast<double>(aTiming.allocations) / aOps)
+            << " allocs/op, " << (aOps / aTiming.seconds) << " ops/s";
+  if (aBytes != 0)
+    std::cout << ", " << (aBytes / aTiming.seconds / 1E6) << " MB/s";
+  std::cout << std::endl;
+}
+
+// Writes every result reported as JSON, for comparing one build with
+// another:
+//   {"seed": <seed>, "benchmarks": [{"name": ..., "ops": ..., "seconds": ...,
+//    "ns_per_op": ..., "allocs_per_op": ..., "ops_per_s": ...,
+//    and for those with a throughput "bytes": ..., "bytes_per_s": ...}, ...]}
+static bool
+writeJSON(const std::string& aPath, uint32_t aSeed)
+{
+  std::ofstream out(aPath.c_str());
+  if (!out)
+  {
+    std::cerr << "Cannot write " << aPath << std::endl;
+    return false;
+  }
+
+  out.precision(10);
+  out << "{" << std::endl
+      << "  \"seed\": " << aSeed << "," << std::endl
+      << "  \"benchmarks\": [" << std::endl;
+  for (uint32_t i = 0; i < sResults.size(); i++)
+  {
+    const BenchResult& r(sResults[i]);
+    out << "    {\"name\": \"" << r.name << "\", \"ops\": " << r.ops
+        << ", \"seconds\": " << r.seconds
+        << ", \"ns_per_op\": " << (r.seconds * 1E9 / r.ops)
+        << ", \"allocs_per_op\": "
+        << (static_cast<double>(r.allocations) / r.ops)
+        << ", \"ops_per_s\": " << (r.ops / r.seconds);
+    if (r.bytes != 0)
+      out << ", \"bytes\": " << r.bytes
+          << ", \"bytes_per_s\": " << (r.bytes / r.seconds);
+    out << "}" << (i + 1 < sResults.size() ? "," : "") << std::endl;
+  }
+  out << "  ]" << std::endl
+      << "}" << std::endl;
+
+  if (!out)
+  {
+    std::cerr << "Cannot write " << aPath << std::endl;
+    return false;
+  }
+  return true;
+}
+
+// Tallies the TFBSs read from a BaSeTraM file, whichever way it is read, the
+// same way the builder's TFBSSink interprets the qualifiers.
+class TFBSTally
+  : public GenBankSink, public TFBSScanSink
+{
+public:
+  TFBSTally()
+    : sites(0), positions(0), probabilities(0.0), factorLength(0),
+      mProbability(0.0), mFactorLength(0), mInTFBS(false),
+      mIsComplement(false), mStart(0), mEnd(0)
+  {
+  }
+
+  void OpenKeyword(const char* name, const char* value) {}
+  void CloseKeyword() {}
+  void CodingData(const char* data) {}
+
+  void
+  OpenFeature(const char* name, const char* location)
+  {
+    mInTFBS = !strcmp(name, "TFBS");
+    if (!mInTFBS)
+      return;
+    mIsComplement = !strncmp(location, "complement(", 11);
+    if (mIsComplement)
+      location += 11;
+    char* p;
+    mStart = strtoul(location, &p, 10);
+    mEnd = strtoul(p + 2, NULL, 10);
+  }
+
+  void
+  CloseFeature()
+  {
+    if (mInTFBS)
+      TFBS(mIsComplement, mStart, mEnd);
+    mInTFBS = false;
+  }
+
+  void
+  Qualifier(const char* name, const char* value)
+  {
+    if (!strcmp(name, "probability"))
+      mProbability = strtod(value, NULL);
+    else if (!strcmp(name, "db_xref") && !strncmp(value, "TRANSFAC:", 9))
+      mFactorLength = strlen(value + 9);
+  }
+
+  void
+  Probability(double aProbability)
+  {
+    mProbability = aProbability;
+  }
+
+  void
+  Factor(const char* aAccession, size_t aLength)
+  {
+    mFactorLength = aLength;
+  }
+
+  void
+  TFBS(bool aIsComplement, uint32_t aStart, uint32_t aEnd)
+  {
+    sites++;
+    positions += aStart + aEnd + aIsComplement;
+    probabilities += mProbability;
+    factorLength += mFactorLength;
+  }
+
+  bool
+  operator==(const TFBSTally& aOther) const
+  {
+    return sites == aOther.sites && positions == aOther.positions &&
+      probabilities == aOther.probabilities &&
+      factorLength == aOther.factorLength;
+  }
+
+  uint64_t sites, positions;
+  double probabilities;
+  uint64_t factorLength;
+
+private:
+  double mProbability;
+  size_t mFactorLength;
+  bool mInTFBS, mIsComplement;
+  uint32_t mStart, mEnd;
+};
+
+// Compares the general GenBank parser against the dedicated TFBSScanner for
+// reading a BaSeTraM output file.
+static bool
+benchTFBSScan(const std::string& aFile, uint32_t aRepeat)
+{
+  uint64_t bytes = boost::filesystem::file_size(aFile);
+  GenBankParser* parser = NewGenBankParser();
+  TFBSScanner scanner;
+  TFBSTally parsed, scanned;
+  Timing parse, scan;
+
+  for (uint32_t r = 0; r < aRepeat; r++)
+  {
+    parsed = TFBSTally();
+    parse.start();
+    TextSource* ts = NewBufferedFileSource(aFile.c_str());
+    parser->SetSink(&parsed);
+    parser->SetSource(ts);
+    parser->Parse();
+    parser->SetSource(NULL);
+    delete ts;
+    parse.stop();
+
+    scanned = TFBSTally();
+    std::string error;
+    scan.start();
+    bool ok = scanner.scanFile(aFile, scanned, error);
+    scan.stop();
+    if (!ok)
+    {
+      std::cerr << "tfbs_scan: " << error << std::endl;
+      delete parser;
+      return false;
+    }
+  }
+  delete parser;
+
+  report("tfbs_scan/genbank_parser", parsed.sites, parse, bytes);
+  report("tfbs_scan/tfbs_scanner", scanned.sites, scan, bytes);
+
+  if (!(parsed == scanned))
+  {
+    std::cerr << "tfbs_scan: parser and scanner disagree!" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Counts and checksums the fields read from matrix.dat, so the regex
+// matcher the builder used to use and the MatrixScanner can be compared.
+class MatrixTally
+  : public MatrixScanSink
+{
+public:
+  MatrixTally()
+    : accessions(0), names(0), entries(0), checksum(2166136261U)
+  {
+  }
+
+  void
+  Accession(const char* aAccession, size_t aLength)
+  {
+    accessions++;
+    add('A', aAccession, aLength);
+  }
+
+  void
+  FactorName(const char* aName, size_t aLength)
+  {
+    names++;
+    add('F', aName, aLength);
+  }
+
+  void
+  EndEntry()
+  {
+    entries++;
+    add('E', "", 0);
+  }
+
+  bool
+  operator==(const MatrixTally& aOther) const
+  {
+    return accessions == aOther.accessions && names == aOther.names &&
+      entries == aOther.entries && checksum == aOther.checksum;
+  }
+
+  uint64_t accessions, names, entries;
+  uint32_t checksum;
+
+private:
+  void
+  add(char aKind, const char* aData, size_t aLength)
+  {
+    // FNV-1a over the kind, the field and its length.
+    checksum = (checksum ^ static_cast<unsigned char>(aKind)) * 16777619U;
+    for (size_t i = 0; i < aLength; i++)
+      checksum = (checksum ^ static_cast<unsigned char>(aData[i])) * 16777619U;
+    checksum = (checksum ^ static_cast<uint32_t>(aLength)) * 16777619U;
+  }
+};
+
+// Reads matrix.dat line by line with the regular expressions the builder
+// used before MatrixScanner.
+static void
+matchMatrices(const std::string& aFile, bool aCompressed, MatrixTally& aTally)
+{
+  static const boost::regex AcPat("^AC[ \\t]+(.*)$");
+  static const boost::regex BfPat("^BF[ \\t]+[^ ]+ ([^;]*);.*$");
+  static const boost::regex NaPat("^NA[ \\t]+([^ ]+).*$");
+
+  boost::iostreams::filtering_istream db;
+  if (aCompressed)
+    db.push(boost::iostreams::gzip_decompressor());
+  db.push(boost::iostreams::file_source(aFile, std::ios::binary));
+
+  while (db.good())
+  {
+    std::string line;
+    std::getline(db, line);
+    boost::smatch res;
+
+    if (line == "//")
+      aTally.EndEntry();
+    else if (boost::regex_match(line, res, AcPat))
+    {
+      std::string field(res[1]);
+      aTally.Accession(field.data(), field.size());
+    }
+    else if (boost::regex_match(line, res, BfPat) ||
+             boost::regex_match(line, res, NaPat))
+    {
+      std::string field(res[1]);
+      aTally.FactorName(field.data(), field.size());
+    }
+  }
+}
+
+// Checks that the MatrixScanner fails on a gzip-compressed matrix.dat cut
+// in half, with and without junk after the cut, rather than reading what it
+// can of it as a short database.
+static bool
+checkDamagedMatrices(const std::string& aFile)
+{
+  std::string data;
+  {
+    std::ifstream in(aFile.c_str(), std::ios::binary);
+    std::ostringstream contents;
+    contents << in.rdbuf();
+    data = contents.str();
+  }
+
+  static const char* const kDamage[] = { "truncated", "corrupt" };
+  boost::filesystem::path damaged(boost::filesystem::temp_directory_path() /
+                                  boost::filesystem::unique_path
+                                  ("tfnet-bench-%%%%-%%%%.dat.gz"));
+  bool ok = true;
+  for (uint32_t d = 0; d < 2; d++)
+  {
+    {
+      std::ofstream out(damaged.string().c_str(), std::ios::binary);
+      out.write(data.data(), data.size() / 2);
+      if (d == 1)
+        out << "not deflate data";
+    }
+
+    MatrixTally tally;
+    std::string error;
+    if (MatrixScanner().scanFile(damaged.string(), tally, error))
+    {
+      std::cerr << "matrix_scan: a " << kDamage[d]
+                << " archive was read without an error!" << std::endl;
+      ok = false;
+    }
+  }
+
+  boost::system::error_code ec;
+  boost::filesystem::remove(damaged, ec);
+  return ok;
+}
+
+// Compares the regular expression matcher against the MatrixScanner for
+// reading the TRANSFAC matrix database, plain or gzip-compressed.
+static bool
+benchMatrixScan(const std::string& aFile, uint32_t aRepeat)
+{
+  uint64_t bytes = boost::filesystem::file_size(aFile);
+  bool compressed = aFile.size() > 3 &&
+    aFile.compare(aFile.size() - 3, 3, ".gz") == 0;
+  MatrixScanner scanner;
+  MatrixTally matched, scanned;
+  Timing match, scan;
+
+  for (uint32_t r = 0; r < aRepeat; r++)
+  {
+    matched = MatrixTally();
+    match.start();
+    matchMatrices(aFile, compressed, matched);
+    match.stop();
+
+    scanned = MatrixTally();
+    std::string error;
+    scan.start();
+    bool ok = scanner.scanFile(aFile, scanned, error);
+    scan.stop();
+    if (!ok)
+    {
+      std::cerr << "matrix_scan: " << error << std::endl;
+      return false;
+    }
+  }
+
+  report("matrix_scan/regex", matched.entries, match, bytes);
+  report("matrix_scan/matrix_scanner", scanned.entries, scan, bytes);
+
+  if (!(matched == scanned))
+  {
+    std::cerr << "matrix_scan: regex and scanner disagree!" << std::endl;
+    return false;
+  }
+
+  return !compressed || checkDamagedMatrices(aFile);
+}
+
+// Compares the per-TFBS binary search against the per-contig sweep for
+// assigning binding sites to gene windows, on a synthetic contig with genes
+// scattered uniformly and sites in position order, as BaSeTraM writes them
+// (or shuffled, to include the cost of sorting them for the sweep).
+static bool
+benchGeneWindows(uint32_t aGenes, uint32_t aSites, uint32_t aLength,
+                 bool aShuffle, uint32_t aRepeat, boost::mt19937& aRng)
+{
+  static const uint32_t kBefore = 1000, kAfter = 15000;
+
+  boost::uniform_int<uint32_t> position(1, aLength);
+  std::vector<Gene> genes;
+  for (uint32_t i = 0; i < aGenes; i++)
+    genes.push_back(Gene(position(aRng), i + 1));
+  std::sort(genes.begin(), genes.end());
+
+  std::vector<uint32_t> starts;
+  for (uint32_t i = 0; i < aSites; i++)
+    starts.push_back(position(aRng));
+  if (aShuffle)
+  {
+    boost::random_number_generator<boost::mt19937, uint32_t> shuffleRng(aRng);
+    std::random_shuffle(starts.begin(), starts.end(), shuffleRng);
+  }
+  else
+    std::sort(starts.begin(), starts.end());
+
+  std::vector<GeneWindow> searched(aSites), swept(aSites);
+  Timing search, sweep;
+
+  for (uint32_t r = 0; r < aRepeat; r++)
+  {
+    search.start();
+    for (uint32_t i = 0; i < aSites; i++)
+      searched[i] = findGeneWindow(genes, starts[i], kBefore, kAfter);
+    search.stop();
+
+    sweep.start();
+    std::vector<uint64_t> keys;
+    keys.reserve(aSites);
+    for (uint32_t i = 0; i < aSites; i++)
+      keys.push_back((static_cast<uint64_t>(starts[i]) << 32) | i);
+    if (std::adjacent_find(keys.begin(), keys.end(), std::greater<uint64_t>())
+        != keys.end())
+      std::sort(keys.begin(), keys.end());
+    sweepGeneWindows(genes, keys, kBefore, kAfter, swept);
+    sweep.stop();
+  }
+
+  report("gene_window/per_tfbs_search", aSites, search);
+  report("gene_window/contig_sweep", aSites, sweep);
+
+  if (searched != swept)
+  {
+    std::cerr << "gene_window: sweep and search disagree!" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// EdgeSwapper's logic over a std::set of the edges, to check it against.
+static uint64_t
+swapEdgesInSet(std::vector<uint64_t>& aEdges, uint64_t aAttempts,
+               boost::mt19937& aRng)
+{
+  std::set<uint64_t> index(aEdges.begin(), aEdges.end());
+  boost::uniform_int<uint32_t> pick(0, aEdges.size() - 1);
+  uint64_t swapped = 0;
+  for (uint64_t n = 0; n < aAttempts; n++)
+  {
+    uint32_t i = pick(aRng), j = pick(aRng);
+    uint64_t a = aEdges[i], b = aEdges[j];
+    uint32_t t1 = edgeTarget(a), r1 = edgeSource(a);
+    uint32_t t2 = edgeTarget(b), r2 = edgeSource(b);
+    if (t1 == t2 || r1 == r2 || t1 == r2 || t2 == r1)
+      continue;
+
+    uint64_t c = packEdge(t1, r2), d = packEdge(t2, r1);
+    if (index.count(c) || index.count(d))
+      continue;
+
+    index.erase(a);
+    index.erase(b);
+    index.insert(c);
+    index.insert(d);
+    aEdges[i] = c;
+    aEdges[j] = d;
+    swapped++;
+  }
+  return swapped;
+}
+
+// Times degree-preserving rewiring of a network model, in attempted swaps,
+// with the edges in a std::set and in EdgeSwapper's hash set, each with the
+// same random numbers so the two must end up with the same network.
+static bool
+benchEdgeSwaps(const std::string& aFile, double aSwapsPerEdge,
+               uint32_t aRepeat, uint32_t aSeed)
+{
+  NetworkModel model;
+  if (!model.load(aFile, std::cerr))
+    return false;
+
+  std::vector<uint64_t> edges;
+  for (uint32_t t = 0; t < model.targetCount(); t++)
+    for (const uint32_t* r = model.regulatorsBegin(t);
+         r != model.regulatorsEnd(t); r++)
+      edges.push_back(packEdge(model.target(t), *r));
+  radixSort(edges);
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+  if (edges.size() < 2)
+  {
+    std::cerr << "edge_swap: " << aFile << " has too few edges." << std::endl;
+    return false;
+  }
+
+  uint64_t attempts = static_cast<uint64_t>(edges.size() * aSwapsPerEdge);
+  std::vector<uint64_t> inSet, swapped;
+  uint64_t setSwaps = 0, swapperSwaps = 0;
+  Timing inStdSet, inSwapper;
+
+  for (uint32_t r = 0; r < aRepeat; r++)
+  {
+    boost::mt19937 rng;
+    inSet = edges;
+    rng.seed(aSeed);
+    inStdSet.start();
+    setSwaps = swapEdgesInSet(inSet, attempts, rng);
+    inStdSet.stop();
+
+    rng.seed(aSeed);
+    inSwapper.start();
+    EdgeSwapper swapper(edges);
+    swapperSwaps = swapper.swap(attempts, rng);
+    inSwapper.stop();
+    swapped = swapper.edges();
+  }
+
+  std::cout << "edge_swap: " << edges.size() << " edges, " << swapperSwaps
+            << " of " << attempts << " swaps made" << std::endl;
+  report("edge_swap/std_set", attempts, inStdSet);
+  report("edge_swap/edge_swapper", attempts, inSwapper);
+
+  if (setSwaps != swapperSwaps || inSet != swapped)
+  {
+    std::cerr << "edge_swap: std::set and EdgeSwapper disagree!" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// A synthetic HGNC name set: gene families of three to five letters, each
+// numbered from 1, some with their members lettered (FAM1A) and some with
+// the first two in Roman numerals (FAMI, FAMII). Alongside it, factor names
+// for them as matrix.dat might give them: as HGNC has them, in lower case,
+// with dashes, with a subunit number or ALPHA after them, or not known to
+// HGNC at all.
+static void
+makeHGNCNames(uint32_t aNames, uint32_t aFactors, boost::mt19937& aRng,
+              std::map<std::string, uint32_t>& aMappings,
+              std::vector<std::string>& aFactorNames)
+{
+  boost::uniform_int<uint32_t> letter(0, 25), members(1, 12), style(0, 9);
+  std::vector<std::string> families, numbers;
+  uint32_t id = 1;
+  while (aMappings.size() < aNames)
+  {
+    std::string family;
+    for (uint32_t l = 3 + letter(aRng) % 3; l > 0; l--)
+      family += static_cast<char>('A' + letter(aRng));
+    uint32_t kind = style(aRng);
+    for (uint32_t m = 1, n = members(aRng); m <= n && aMappings.size() < aNames;
+         m++)
+    {
+      std::ostringstream number;
+      number << m;
+      std::string name(family + number.str());
+      if (kind == 0)
+        name += 'A';
+      else if (kind == 1 && m <= 2)
+        name = family + (m == 1 ? "I" : "II");
+      aMappings.insert(std::pair<std::string, uint32_t>(name, id++));
+      families.push_back(family);
+      numbers.push_back(number.str());
+    }
+  }
+
+  boost::uniform_int<uint32_t> pick(0, families.size() - 1), form(0, 5);
+  for (uint32_t i = 0; i < aFactors; i++)
+  {
+    uint32_t f = pick(aRng);
+    std::string name(families[f] + numbers[f]);
+    switch (form(aRng))
+    {
+    case 1:
+      name = boost::algorithm::to_lower_copy(name);
+      break;
+    case 2:
+      name = families[f] + "-" + numbers[f];
+      break;
+    case 3:
+      name += "-1";
+      break;
+    case 4:
+      name += "alpha";
+      break;
+    case 5:
+      name = "X" + name + "R";
+      break;
+    }
+    aFactorNames.push_back(name);
+  }
+}
+
+// Times resolving factor names to HGNC IDs as the builder does when reading
+// matrix.dat: cleanupHGNCName(), then findHGNCIdByName() and a freshly
+// compiled HGNCResolver on the cleaned up names, which must agree.
+static bool
+benchHGNCNames(uint32_t aNames, uint32_t aLookups, uint32_t aRepeat,
+               boost::mt19937& aRng)
+{
+  std::map<std::string, uint32_t> mappings;
+  std::vector<std::string> factorNames;
+  makeHGNCNames(aNames, aLookups, aRng, mappings, factorNames);
+
+  std::vector<std::string> cleaned(aLookups);
+  std::vector<uint32_t> found(aLookups), resolved(aLookups);
+  Timing cleanup, lookup, resolve;
+
+  for (uint32_t r = 0; r < aRepeat; r++)
+  {
+    cleanup.start();
+    for (uint32_t i = 0; i < aLookups; i++)
+      cleaned[i] = cleanupHGNCName(factorNames[i]);
+    cleanup.stop();
+
+    lookup.start();
+    for (uint32_t i = 0; i < aLookups; i++)
+      found[i] = findHGNCIdByName(mappings, cleaned[i]);
+    lookup.stop();
+
+    HGNCResolver resolver;
+    resolver.compile(mappings);
+    resolve.start();
+    for (uint32_t i = 0; i < aLookups; i++)
+      resolved[i] = resolver.resolve(cleaned[i]);
+    resolve.stop();
+  }
+
+  uint32_t mapped = aLookups - std::count(found.begin(), found.end(), 0);
+  std::cout << "hgnc_names: " << mappings.size() << " HGNC names, "
+            << mapped << " of " << aLookups << " factor names mapped"
+            << std::endl;
+  report("hgnc_names/cleanup_hgnc_name", aLookups, cleanup);
+  report("hgnc_names/find_hgnc_id_by_name", aLookups, lookup);
+  report("hgnc_names/hgnc_resolver", aLookups, resolve);
+
+  if (found != resolved)
+  {
+    std::cerr << "hgnc_names: findHGNCIdByName and HGNCResolver disagree!"
+              << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Builds the model from a network and writes it out, as generateOutput()
+// does, into aOutput.
+static void
+writeNetwork(NetworkAccumulator& aNetwork,
+             const std::map<uint32_t, std::string>& aNames, bool aBinary,
+             std::string& aOutput)
+{
+  NetworkModel model;
+  aNetwork.buildModel(1, aNames, model);
+  std::ostringstream out;
+  if (aBinary)
+    model.writeBinary(out);
+  else
+    model.writeText(out);
+  aOutput = out.str();
+}
+
+// Times accumulating a network one processEdge() call at a time, as the
+// builder does for each gene window a TFBS falls in, and writing it out in
+// each format. The calls are for edges from aRegulators factors' genes to
+// aTargets genes, with IDs scattered over the HGNC ID range; with no more
+// targets than TFNetBuilder takes, every call adds to the network. The
+// network is left in aModel, for the perturbers.
+static bool
+benchNetworkOutput(uint32_t aEdges, uint32_t aTargets, uint32_t aRegulators,
+                   uint32_t aRepeat, boost::mt19937& aRng, NetworkModel& aModel)
+{
+  boost::uniform_int<uint32_t> hgncId(1, 50000);
+  std::vector<uint32_t> targets, regulators;
+  std::map<uint32_t, std::string> names;
+  for (uint32_t i = 0; i < aTargets + aRegulators; i++)
+  {
+    uint32_t id = hgncId(aRng);
+    (i < aTargets ? targets : regulators).push_back(id);
+    std::ostringstream name;
+    name << "GENE" << id;
+    names[id] = name.str();
+  }
+
+  boost::uniform_int<uint32_t> target(0, aTargets - 1);
+  boost::uniform_int<uint32_t> regulator(0, aRegulators - 1);
+  std::vector<std::pair<uint32_t, uint32_t> > calls;
+  for (uint32_t i = 0; i < aEdges; i++)
+    calls.push_back(std::pair<uint32_t, uint32_t>
+                    (targets[target(aRng)], regulators[regulator(aRng)]));
+
+  NetworkAccumulator* network = NULL;
+  std::string text, binary;
+  Timing insert, writeText, writeBinary;
+  uint32_t rejected = 0;
+
+  for (uint32_t r = 0; r < aRepeat; r++)
+  {
+    delete network;
+    network = new NetworkAccumulator();
+    rejected = 0;
+    insert.start();
+    for (uint32_t i = 0; i < aEdges; i++)
+      if (!network->processEdge(calls[i].first, calls[i].second))
+        rejected++;
+    network->edges.edges();
+    insert.stop();
+
+    writeText.start();
+    writeNetwork(*network, names, false, text);
+    writeText.stop();
+
+    writeBinary.start();
+    writeNetwork(*network, names, true, binary);
+    writeBinary.stop();
+  }
+
+  network->buildModel(1, names, aModel);
+  uint64_t edges = network->edges.edges().size();
+  delete network;
+
+  std::cout << "process_edge: " << aEdges << " calls made, " << edges
+            << " distinct edges" << std::endl;
+  report("process_edge/insert", aEdges, insert);
+  report("generate_output/text", edges, writeText, text.size());
+  report("generate_output/binary", edges, writeBinary, binary.size());
+
+  if (rejected != 0 || aModel.edgeCount() != edges)
+  {
+    std::cerr << "process_edge: " << rejected << " calls rejected, and "
+              << aModel.edgeCount() << " edges written of " << edges
+              << "!" << std::endl;
+    return false;
+  }
+
+  return true;
+}
+
+// Times each of the perturbers, with its default parameters, on aModel; an
+// op is one perturbed copy.
+static bool
+benchPerturbers(const NetworkModel& aModel, uint32_t aRepeat, uint32_t aSeed)
+{
+  std::vector<std::string> names;
+  ModelPerturber::perturberNames(names);
+
+  bool ok = true;
+  for (uint32_t n = 0; n < names.size(); n++)
+  {
+    ModelPerturber* perturber = ModelPerturber::findPerturberByName(names[n]);
+    perturber->resetParams();
+
+    Timing timing;
+    std::string error;
+    for (uint32_t r = 0; r < aRepeat && error == ""; r++)
+    {
+      boost::mt19937 rng;
+      rng.seed(aSeed);
+      NetworkModel result;
+      timing.start();
+      if (!perturber->perturb(aModel, result, rng, error) && error == "")
+        error = "failed";
+      timing.stop();
+    }
+
+    if (error != "")
+    {
+      std::cerr << "perturb/" << names[n] << ": " << error << std::endl;
+      ok = false;
+    }
+    else
+      report("perturb/" + names[n], 1, timing);
+  }
+
+  return ok;
+}
+
+int
+main(int argc, char** argv)
+{
+  uint32_t seed, genes, sites, length, hgncNames, lookups, edges, targets,
+    regulators, repeat;
+  std::string tfbsFile, matrixFile, networkFile, json;
+  double swapsPerEdge;
+
+  po::options_description desc;
+
+  desc.add_options()
+    ("seed", po::value<uint32_t>(&seed)->default_value(1), "Random seed for "
+     "the synthetic data")
+    ("genes", po::value<uint32_t>(&genes)->default_value(2000), "Genes per "
+     "contig")
+    ("sites", po::value<uint32_t>(&sites)->default_value(5000000), "TFBSs per "
+     "contig")
+    ("length", po::value<uint32_t>(&length)->default_value(100000000),
+     "Contig length")
+    ("unsorted-sites", "Present the TFBSs out of position order")
+    ("hgnc-names", po::value<uint32_t>(&hgncNames)->default_value(40000),
+     "Names in the synthetic HGNC set")
+    ("lookups", po::value<uint32_t>(&lookups)->default_value(200000),
+     "Factor names to resolve to HGNC IDs")
+    ("edges", po::value<uint32_t>(&edges)->default_value(1000000), "Calls to "
+     "processEdge() to build the synthetic network with")
+    ("targets", po::value<uint32_t>(&targets)->default_value(2000), "Genes "
+     "regulated in the synthetic network")
+    ("regulators", po::value<uint32_t>(&regulators)->default_value(200),
+     "Genes regulating others in the synthetic network")
+    ("tfbs-file", po::value<std::string>(&tfbsFile), "BaSeTraM output file "
+     "to time the TFBS readers on")
+    ("matrix-file", po::value<std::string>(&matrixFile), "TRANSFAC "
+     "matrix.dat (optionally gzipped, named .gz) to time the matrix readers "
+     "on")
+    ("network-file", po::value<std::string>(&networkFile), "TF net model "
+     "(text or binary) to time degree-preserving edge swaps on")
+    ("swaps-per-edge", po::value<double>(&swapsPerEdge)->default_value(10),
+     "Number of edge swaps to attempt for each edge of the network")
+    ("repeat", po::value<uint32_t>(&repeat)->default_value(3), "Number of "
+     "times to repeat each benchmark (the best time is reported)")
+    ("json", po::value<std::string>(&json), "File to write the results to "
+     "as JSON")
+    ("help", "produce help message")
+    ;
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  if (vm.count("help"))
+  {
+    std::cout << desc << std::endl;
+    return 1;
+  }
+
+  boost::mt19937 rng;
+  rng.seed(seed);
+
+  if (repeat == 0 || lookups == 0 || edges == 0 || targets == 0 ||
+      regulators == 0)
+  {
+    std::cerr << "--repeat, --lookups, --edges, --targets and --regulators "
+              << "must be at least 1." << std::endl;
+    return 1;
+  }
+
+  bool ok = benchGeneWindows(genes, sites, length,
+                             vm.count("unsorted-sites") != 0, repeat, rng);
+  ok = benchHGNCNames(hgncNames, lookups, repeat, rng) && ok;
+  NetworkModel model;
+  ok = benchNetworkOutput(edges, targets, regulators, repeat, rng, model) &&
+    ok;
+  ok = benchPerturbers(model, repeat, seed) && ok;
+  if (tfbsFile != "")
+    ok = benchTFBSScan(tfbsFile, repeat) && ok;
+  if (matrixFile != "")
+    ok = benchMatrixScan(matrixFile, repeat) && ok;
+  if (networkFile != "")
+    ok = benchEdgeSwaps(networkFile, swapsPerEdge, repeat, seed) && ok;
+  if (json != "")
+    ok = writeJSON(json, seed) && ok;
+
+  return ok ? 0 : 1;
+}
@@ -1,626 +1,2439 @@
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
 #include "../parsegenbank/GenbankParser.hpp"
+#include "GeneWindows.hpp"
+#include "PackedEdges.hpp"
+#include "NetworkModel.hpp"
+#include "NetworkAccumulator.hpp"
+#include "TFBSScanner.hpp"
+#include "GeneExtractor.hpp"
+#include "MatrixScanner.hpp"
+#include "HGNCLoader.hpp"
+#include "HGNCResolver.hpp"
+#include "Tracer.hpp"
+#include "BuildMetrics.hpp"
+#include "ContigPrefetcher.hpp"
 #include <iostream>
 #include <boost/iostreams/device/file.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
-#include <boost/tokenizer.hpp>
-#include <boost/regex.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/algorithm/string/case_conv.hpp>
-#include <boost/algorithm/string/replace.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind/bind.hpp>
+#include <fstream>
+#include <sstream>
+#include <cstddef>
+#include <cerrno>
+#include <cctype>
+#include <unistd.h>
 
 namespace po = boost::program_options;
 namespace fs = boost::filesystem;
 namespace io = boost::iostreams;
 
-class Gene
+// A name beside aPath to write a new copy of it under before renaming it
+// into place, unique to this writer: concurrent runs, and threads of this
+// one, each get their own, so no two ever write the same temporary.
+static std::string
+tempPathFor(const std::string& aPath)
+{
+  static boost::mutex sMutex;
+  static uint32_t sCount = 0;
+  uint32_t count;
+  {
+    boost::mutex::scoped_lock lock(sMutex);
+    count = sCount++;
+  }
+
+  std::ostringstream tmp;
+  tmp << aPath << ".tmp." << getpid() << "." << count;
+  return tmp.str();
+}
+
+// Renames aTmp over aPath, or reports why not and removes aTmp.
+static bool
+replaceWithTemp(const std::string& aTmp, const std::string& aPath)
+{
+  boost::system::error_code ec;
+  fs::rename(aTmp, aPath, ec);
+  if (!ec)
+    return true;
+
+  std::cerr << "Could not replace " << aPath << ": " << ec.message()
+            << std::endl;
+  fs::remove(aTmp, ec);
+  return false;
+}
+
+// Interns TRANSFAC accessions as dense factor IDs (0, 1, 2, ...). Lookups
+// work straight off the parser's buffer, so resolving a TFBS to its factor
+// costs one hash and one memcmp, with no std::string built.
+class FactorTable
 {
 public:
-  Gene(uint32_t aOffset, uint32_t aHgncId = 1)
-    : offset(aOffset), hgncId(aHgncId)
+  static const uint32_t kNoFactor = 0xFFFFFFFF;
+
+  FactorTable()
+    : mOffsets(1, 0), mSlots(16, kNoFactor)
   {
   }
 
-  bool
-  operator<(const Gene& aGene) const
+  uint32_t
+  size() const
   {
-    return (offset < aGene.offset);
+    return mOffsets.size() - 1;
   }
 
-  uint32_t offset;
-  uint32_t hgncId;
-};
+  std::string
+  accession(uint32_t aFactor) const
+  {
+    return mPool.substr(mOffsets[aFactor],
+                        mOffsets[aFactor + 1] - mOffsets[aFactor]);
+  }
 
-class TFNetBuilder
-  : public GenBankSink
-{
-public:
-  TFNetBuilder(const fs::path& aBaSeTraM)
-    : mTFBSProcessed(0), mEdgeCalls(0), mTFBSUsed(0), mTFBSUnused(0),
-      mTFBSUsedProbs(0.0), mTFBSUnusedProbs(0.0), nRegulated(0),
-      mBaSeTraM(aBaSeTraM), mGBP(NewGenBankParser()),
-      mBTP(NewGenBankParser()), mComplement(false), mTFBSSink(this)
+  uint32_t
+  find(const char* aAccession, size_t aLength) const
+  {
+    size_t mask = mSlots.size() - 1;
+    for (size_t i = hash(aAccession, aLength) & mask; ; i = (i + 1) & mask)
+    {
+      uint32_t factor = mSlots[i];
+      if (factor == kNoFactor)
+        return kNoFactor;
+      if (mOffsets[factor + 1] - mOffsets[factor] == aLength &&
+          !memcmp(mPool.data() + mOffsets[factor], aAccession, aLength))
+        return factor;
+    }
+  }
+
+  uint32_t
+  find(const std::string& aAccession) const
+  {
+    return find(aAccession.data(), aAccession.size());
+  }
+
+  // Returns the ID for aAccession, adding it if it is new.
+  uint32_t
+  intern(const std::string& aAccession, bool& aAdded)
+  {
+    uint32_t factor = find(aAccession);
+    aAdded = (factor == kNoFactor);
+    if (!aAdded)
+      return factor;
+
+    factor = size();
+    mPool += aAccession;
+    mOffsets.push_back(mPool.size());
+
+    // Keep the table at most half full.
+    if (size() * 2 > mSlots.size())
+    {
+      std::vector<uint32_t> slots(mSlots.size() * 2, kNoFactor);
+      mSlots.swap(slots);
+      for (uint32_t f = 0; f < factor; f++)
+        insertSlot(f);
+    }
+    insertSlot(factor);
+
+    return factor;
+  }
+
+  void
+  clear()
   {
-    mGBP->SetSink(this);
-    mBTP->SetSink(&mTFBSSink);
+    mPool.clear();
+    mOffsets.assign(1, 0);
+    mSlots.assign(16, kNoFactor);
   }
 
-  ~TFNetBuilder()
+private:
+  static size_t
+  hash(const char* aData, size_t aLength)
   {
-    delete mGBP;
-    delete mBTP;
+    // FNV-1a
+    uint32_t h = 2166136261U;
+    for (size_t i = 0; i < aLength; i++)
+      h = (h ^ static_cast<unsigned char>(aData[i])) * 16777619U;
+    return h;
   }
 
   void
-  generateOutput(std::ostream& aOutput)
+  insertSlot(uint32_t aFactor)
   {
-    aOutput << "VERTICES" << std::endl;
-    for
-    (
-     std::map<uint32_t, uint32_t>::iterator i = mUsedHGNCIds.begin();
-     i != mUsedHGNCIds.end();
-     i++
-    )
-      if ((*i).second >= kMinRegs)
-        aOutput << "VERTEX " << (*i).first << " " << mNameByHGNCId[(*i).first]
-                << std::endl;
-    aOutput << "ENDVERTICES" << std::endl;
+    size_t mask = mSlots.size() - 1;
+    size_t i = hash(mPool.data() + mOffsets[aFactor],
+                    mOffsets[aFactor + 1] - mOffsets[aFactor]) & mask;
+    while (mSlots[i] != kNoFactor)
+      i = (i + 1) & mask;
+    mSlots[i] = aFactor;
+  }
 
-    uint32_t nEdges = 0;
+  std::string mPool;
+  std::vector<uint32_t> mOffsets, mSlots;
+};
 
-    // Now build a multimap of edges by source...
-    std::multimap<uint32_t, uint32_t> edges;
-    for
-    (
-     std::set<std::pair<uint32_t, uint32_t> >::iterator i = mEdges.begin();
-     i != mEdges.end();
-     i++
-    )
+const uint32_t FactorTable::kNoFactor;
+
+// The HGNC and TRANSFAC indices are compiled into a snapshot file so that
+// later runs can skip re-parsing the HGNC TSV and matrix.dat. The snapshot
+// is a header followed by three flat tables, each a sorted array of string
+// offsets (count + 1 entries, into a shared string pool) and an ID array,
+// then the pool, then the compiled HGNCResolver table. It is only used if
+// the size and mtime of both source files match, and the HGNC tables are
+// read in place from the mapping rather than loaded.
+class IndexSnapshot
+{
+public:
+  enum
+  {
+    kHGNCIdByName,
+    kHGNCByTRANSFAC,
+    kNameByHGNCId,
+    kTableCount
+  };
+
+  struct Table
+  {
+    uint64_t idsOffset, stringOffsetsOffset;
+    uint32_t count, padding;
+  };
+
+  struct Header
+  {
+    char magic[8];
+    uint32_t version, byteOrder;
+    uint64_t hgncSize, matricesSize;
+    int64_t hgncMTime, matricesMTime;
+    Table tables[kTableCount];
+    uint64_t poolOffset, poolSize;
+    uint64_t resolverOffset, resolverSize;
+  };
+
+  // One of the tables, looked at in place.
+  class TableView
+  {
+  public:
+    TableView()
+      : mIds(NULL), mOffsets(NULL), mPool(NULL), mCount(0)
     {
-      if (mUsedHGNCIds[(*i).second] >= kMinRegs)
-      {
-        nEdges++;
-        
-        edges.insert(*i);
-      }
     }
 
-    for
-    (
-     std::map<uint32_t, uint32_t>::iterator i = mUsedHGNCIds.begin();
-     i != mUsedHGNCIds.end();
-     i++
-    )
+    TableView(const char* aBase, const Table& aTable, const char* aPool)
+      : mIds(reinterpret_cast<const uint32_t*>(aBase + aTable.idsOffset)),
+        mOffsets(reinterpret_cast<const uint32_t*>
+                 (aBase + aTable.stringOffsetsOffset)),
+        mPool(aPool), mCount(aTable.count)
     {
-      if ((*i).second < kMinRegs)
-        continue;
+    }
 
-      std::multimap<uint32_t, uint32_t>::iterator j(edges.find((*i).first));
+    uint32_t
+    size() const
+    {
+      return mCount;
+    }
 
-      if (j == edges.end())
-        continue;
+    uint32_t
+    id(uint32_t aIndex) const
+    {
+      return mIds[aIndex];
+    }
 
-      aOutput << "EDGES " << (*i).first
-              << " (";
-      for
-      (
-       ;
-       j != edges.end() && (*j).first == (*i).first;
-       j++
-      )
-        aOutput << (*j).second << " ";
-      aOutput << ")" << std::endl;
+    std::string
+    string(uint32_t aIndex) const
+    {
+      return std::string(mPool + mOffsets[aIndex],
+                         mOffsets[aIndex + 1] - mOffsets[aIndex]);
+    }
+
+    // Finds the string for aId by binary search, in a table sorted by ID.
+    bool
+    findById(uint32_t aId, std::string& aString) const
+    {
+      const uint32_t* i = std::lower_bound(mIds, mIds + mCount, aId);
+      if (i == mIds + mCount || *i != aId)
+        return false;
+      aString = string(i - mIds);
+      return true;
     }
 
-    aOutput << "# There are " << nEdges << " edges" << std::endl
-            << "# " << mTFBSProcessed
-            << " transcription factor binding sites processed."
-            << std::endl
-            << "# Total number of gene-TFBS region overlaps: " << mEdgeCalls
-            << "." << std::endl
-            << "# Average probability for TFBS assigned to genes: "
-            << (mTFBSUsedProbs / mTFBSUsed) << std::endl
-            << "# Average probability for TFBS not assigned to genes: "
-            << (mTFBSUnusedProbs / mTFBSUnused) << std::endl;
+  private:
+    const uint32_t* mIds, * mOffsets;
+    const char* mPool;
+    uint32_t mCount;
+  };
+
+  static const uint32_t kVersion = 2, kByteOrder = 0x01020304;
+
+  // Returns false if either source cannot be looked at, which the caller
+  // treats as the snapshot not matching.
+  static bool
+  initHeader(Header& aHeader, const std::string& aHGNC,
+             const std::string& aMatrices)
+  {
+    memset(&aHeader, 0, sizeof(aHeader));
+    memcpy(aHeader.magic, "TFNIDX\0\0", 8);
+    aHeader.version = kVersion;
+    aHeader.byteOrder = kByteOrder;
+
+    boost::system::error_code ec[4];
+    aHeader.hgncSize = fs::file_size(aHGNC, ec[0]);
+    aHeader.hgncMTime = fs::last_write_time(aHGNC, ec[1]);
+    aHeader.matricesSize = fs::file_size(aMatrices, ec[2]);
+    aHeader.matricesMTime = fs::last_write_time(aMatrices, ec[3]);
+    return !ec[0] && !ec[1] && !ec[2] && !ec[3];
   }
+};
 
-  void
-  indexMatrices(const std::string& aPath)
+// A per-chromosome sidecar holding the sorted gene arrays of each contig,
+// so a chromosome whose GenBank file has not changed need not be read
+// again. It is keyed by the file's size, modification time and a hash of its
+// contents. The header is followed, for each contig, by a ContigHeader, the
+// contig name padded to 4 bytes, and the forward then reverse genes as
+// (offset, hgncId) pairs.
+class GeneCache
+{
+public:
+  struct Header
   {
-    static const boost::regex AcPat("^AC[ \\t]+(.*)$");
-    static const boost::regex BfPat("^BF[ \\t]+[^ ]+ ([^;]*);.*$");
-    static const boost::regex NaPat("^NA[ \\t]+([^ ]+).*$");
+    char magic[8];
+    uint32_t version, byteOrder;
+    uint64_t sourceSize;
+    int64_t sourceMTime;
+    uint64_t sourceHash;
+    uint32_t contigCount, padding;
+  };
 
-    io::filtering_istream db;
-    db.push(io::file_source(aPath));
+  struct ContigHeader
+  {
+    uint32_t nameLength, forwardCount, reverseCount, padding;
+  };
 
-    bool seenAC(false);
-    std::string AC;
-    std::set<std::string> BF;
+  static const uint32_t kVersion = 1, kByteOrder = 0x01020304;
 
-    while (db.good())
+  static bool
+  initHeader(Header& aHeader, const std::string& aSource)
+  {
+    memset(&aHeader, 0, sizeof(aHeader));
+    memcpy(aHeader.magic, "TFNGENE\0", 8);
+    aHeader.version = kVersion;
+    aHeader.byteOrder = kByteOrder;
+    try
+    {
+      aHeader.sourceSize = fs::file_size(aSource);
+      aHeader.sourceMTime = fs::last_write_time(aSource);
+    }
+    catch (const fs::filesystem_error& e)
     {
-      std::string line;
-      std::getline(db, line);
-      boost::smatch res;
+      return false;
+    }
+    return hashFile(aSource, aHeader.sourceSize, aHeader.sourceHash);
+  }
 
-      if (line == "//")
-      {
-        if (BF.size() && seenAC)
-        {
-          for
-          (
-           std::set<std::string>::iterator j(BF.begin());
-           j != BF.end();
-           j++
-          )
-          {
-            uint32_t id(findHGNCIdByName(*j));
-            if (id != 0)
-              mHGNCByTRANSFAC.insert(std::pair<std::string, uint32_t>(AC, id));
-          }
-        }
-        seenAC = false;
-        BF.clear();
-      }
-      else if (boost::regex_match(line, res, AcPat))
+  // A multiplicative hash over 8 byte words; it only has to notice that a
+  // file has changed, and runs at close to memory speed.
+  static bool
+  hashFile(const std::string& aSource, uint64_t aSize, uint64_t& aHash)
+  {
+    uint64_t h = 0xcbf29ce484222325ULL ^ aSize;
+    if (aSize != 0)
+    {
+      io::mapped_file_source source;
+      try
       {
-        AC = res[1];
-        seenAC = true;
+        source.open(aSource);
       }
-      else if (boost::regex_match(line, res, BfPat))
+      catch (const std::exception& e)
       {
-        BF.insert(cleanup_HGNC_name(res[1]));
+        return false;
       }
-      else if (boost::regex_match(line, res, NaPat))
+
+      const char* p = source.data();
+      size_t n = source.size();
+      for (; n >= 8; p += 8, n -= 8)
       {
-        BF.insert(cleanup_HGNC_name(res[1]));
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0x100000001b3ULL;
+        h ^= h >> 29;
       }
+      for (; n > 0; p++, n--)
+        h = (h ^ static_cast<unsigned char>(*p)) * 0x100000001b3ULL;
     }
+    aHash = h ^ (h >> 32);
+    return true;
   }
 
-  void
-  loadHGNCDatabase(const std::string& aPath)
+  static fs::path
+  sidecarPath(const fs::path& aCacheDir, const std::string& aSource)
+  {
+    return aCacheDir / (fs::basename(aSource) + ".genes");
+  }
+};
+
+// A per-chromosome record of what each contig contributed to every network:
+// the same counts, sites and edges a shard collects for mergeShard() to
+// replay, so a rerun only has to process the contigs whose inputs changed.
+// Each contig's entry is keyed by a hash of the build parameters, its genes,
+// the size and modification time of its BaSeTraM output, and the state the
+// TFBS reader carried into it. After the header, each contig is a
+// ContigHeader and its name, then for each network a NetworkHeader, the
+// site probabilities, the per-site edge counts and the (target, source)
+// edge pairs.
+class ContigCache
+{
+public:
+  struct Header
   {
-    io::filtering_istream db;
-    db.push(io::file_source(aPath));
+    char magic[8];
+    uint32_t version, byteOrder;
+    uint64_t paramsHash;
+    uint32_t networkCount, contigCount;
+  };
 
-    // Skip the header...
-    std::string entry;
-    std::getline(db, entry);
+  struct ContigHeader
+  {
+    uint64_t key;
+    uint32_t nameLength, exitFactor;
+    double exitProbability;
+  };
 
-    while (db.good())
-    {
-      std::getline(db, entry);
+  struct NetworkHeader
+  {
+    uint32_t tfbsProcessed, edgeCalls, unmappedSites, siteCount;
+    uint64_t edgeCount;
+  };
 
-      boost::tokenizer<boost::char_separator<char> >
-        tok(entry, boost::char_separator<char>("\t", "",
-                                               boost::keep_empty_tokens));
-      std::vector<std::string> v(tok.begin(), tok.end());
+  static const uint32_t kVersion = 1, kByteOrder = 0x01020304;
 
-      if (v.size() < 6)
-        continue;
+  static void
+  initHeader(Header& aHeader, uint64_t aParamsHash, uint32_t aNetworks)
+  {
+    memset(&aHeader, 0, sizeof(aHeader));
+    memcpy(aHeader.magic, "TFNCONT\0", 8);
+    aHeader.version = kVersion;
+    aHeader.byteOrder = kByteOrder;
+    aHeader.paramsHash = aParamsHash;
+    aHeader.networkCount = aNetworks;
+  }
 
-      if (v[3] != "Approved")
-        continue;
+  // FNV-1a, continuing from aHash.
+  static uint64_t
+  hash(uint64_t aHash, const void* aData, size_t aLength)
+  {
+    const unsigned char* p = static_cast<const unsigned char*>(aData);
+    for (size_t i = 0; i < aLength; i++)
+      aHash = (aHash ^ p[i]) * 0x100000001b3ULL;
+    return aHash;
+  }
 
-      uint32_t hgncId = strtoul(v[0].c_str(), NULL, 10);
-      addHGNCMapping(v[1], hgncId, true);
+  static const uint64_t kHashSeed = 0xcbf29ce484222325ULL;
 
-      static const boost::regex rtok("[, ]+");
+  static fs::path
+  sidecarPath(const fs::path& aCacheDir, const std::string& aSource)
+  {
+    return aCacheDir / (fs::basename(aSource) + ".contigs");
+  }
+};
 
-      addHGNCMapping(v[2], hgncId, false);
+// The settings that decide what goes into a network: TFBSs with at least
+// minProbability are linked to the genes starting up to upstream bases after
+// or downstream bases before them, and genes used fewer than minRegs times
+// are left out of the output.
+class WindowConfig
+{
+public:
+  static const uint32_t kUpstreamZone = 15000, kDownstreamZone = 1000, kMinRegs = 1;
+  static const double kMinProbability;
 
-      boost::sregex_token_iterator rti1
-        (make_regex_token_iterator(v[4], rtok, -1));
-      boost::sregex_token_iterator end;
-      for (; rti1 != end; rti1++)
-        addHGNCMapping(*rti1, hgncId, false);
+  WindowConfig()
+    : upstream(kUpstreamZone), downstream(kDownstreamZone),
+      minProbability(kMinProbability), minRegs(kMinRegs)
+  {
+  }
 
-      boost::sregex_token_iterator rti2
-        (make_regex_token_iterator(v[5], rtok, -1));
-      for (; rti2 != end; rti2++)
-        addHGNCMapping(*rti2, hgncId, false);
-    }
+  // Reads "upstream,downstream[,minProbability[,minRegs]]"; fields left
+  // off keep their defaults.
+  bool
+  parse(const std::string& aSpec)
+  {
+    *this = WindowConfig();
+
+    std::vector<std::string> fields;
+    boost::split(fields, aSpec, boost::is_any_of(","));
+    if (fields.size() < 2 || fields.size() > 4)
+      return false;
+
+    return parseUInt(fields[0], upstream) &&
+      parseUInt(fields[1], downstream) &&
+      (fields.size() < 3 || parseDouble(fields[2], minProbability)) &&
+      (fields.size() < 4 || parseUInt(fields[3], minRegs));
   }
 
-  void
-  processChromosome(const std::string& aFile)
+  // Names the configuration for its output file. The probability is
+  // written with as many digits as it takes to read back the same, so
+  // different configurations never share a name.
+  std::string
+  name() const
   {
-    TextSource* ts = NewBufferedFileSource(aFile.c_str());
-    mGBP->SetSource(ts);
+    std::ostringstream n;
+    n << "u" << upstream << "_d" << downstream << "_p"
+      << shortestDouble(minProbability) << "_r" << minRegs;
+    return n.str();
+  }
 
-    mChromosomeDir = mBaSeTraM;
-    mChromosomeDir /= fs::basename(aFile);
+  uint32_t upstream, downstream;
+  double minProbability;
+  uint32_t minRegs;
 
-    try
-    {
-      mGBP->Parse();
-    }
-    catch (ParserException& pe)
-    {
-      std::cout << "Parse error: " << pe.what() << std::endl;
-    }
+private:
+  // Takes digits only: strtoul() would also take a sign, wrapping "-5"
+  // round to a huge zone, and leading spaces.
+  static bool
+  parseUInt(const std::string& aField, uint32_t& aValue)
+  {
+    if (aField == "" || !isdigit(static_cast<unsigned char>(aField[0])))
+      return false;
+    char* end;
+    errno = 0;
+    unsigned long value = strtoul(aField.c_str(), &end, 10);
+    if (*end != 0 || errno == ERANGE || value > 0xFFFFFFFFUL)
+      return false;
+    aValue = value;
+    return true;
+  }
 
-    mGBP->SetSource(NULL);
-    delete ts;
+  static bool
+  parseDouble(const std::string& aField, double& aValue)
+  {
+    char* end;
+    aValue = strtod(aField.c_str(), &end);
+    return aField != "" && *end == 0;
   }
 
-  void
-  OpenKeyword(const char* name, const char* value)
+  static std::string
+  shortestDouble(double aValue)
   {
-    if (!::strcmp(name, "LOCUS"))
+    std::string text;
+    for (int precision = 6; precision <= 17; precision++)
     {
-      dealWithContig();
-      
-      mContigFile = mChromosomeDir;
-
-      std::string locus(value);
-      size_t pos = locus.find(" ");
-      mContigFile /= locus.substr(0, pos);
+      std::ostringstream out;
+      out.precision(precision);
+      out << aValue;
+      text = out.str();
+      if (strtod(text.c_str(), NULL) == aValue)
+        break;
     }
+    return text;
   }
+};
 
-  void
-  CloseKeyword()
+const double WindowConfig::kMinProbability = 0.5;
+
+class TFNetBuilder
+{
+public:
+  TFNetBuilder(const fs::path& aBaSeTraM)
+    : mBaSeTraM(aBaSeTraM), mBatchSweep(true), mFastTFBS(false),
+      mFastGenes(false), mMetrics(NULL), mPrefetchBudget(0),
+      mWorkerPrefetchBudget(0), mSnapshotResolver(NULL),
+      mSnapshotResolverSize(0)
   {
+    mNetworks.push_back(Network(WindowConfig()));
   }
 
+  // Builds one network for each configuration, all from the same pass over
+  // the data, in place of the single default one.
   void
-  OpenFeature(const char* name, const char* location)
+  setWindowConfigs(const std::vector<WindowConfig>& aConfigs)
   {
-    if (!::strcmp(name, "gene"))
-    {
-      if (!::strncmp(location, "complement(", 11))
-      {
-        mComplement = true;
-        location += 11;
-      }
-      else
-        mComplement = false;
-
-      mGeneStart = strtoul(location, NULL, 10);
+    mNetworks.clear();
+    for (uint32_t i = 0; i < aConfigs.size(); i++)
+      mNetworks.push_back(Network(aConfigs[i]));
+  }
 
-      location = strchr(location, '.');
-      if (location == NULL)
-        return;
-      location += 2;
+  uint32_t
+  networkCount() const
+  {
+    return mNetworks.size();
+  }
 
-      mGeneEnd = strtoul(location, NULL, 10);
-    }
+  const WindowConfig&
+  windowConfig(uint32_t aNetwork) const
+  {
+    return mNetworks[aNetwork].config;
   }
 
+  // Selects between assigning TFBSs to gene windows a contig at a time with
+  // a sweep (the default) or one at a time with a binary search each.
   void
-  CloseFeature()
+  setBatchSweep(bool aBatchSweep)
   {
+    mBatchSweep = aBatchSweep;
   }
 
+  // Selects between reading the BaSeTraM output with the dedicated
+  // TFBSScanner or with the general GenBank parser (the default).
   void
-  Qualifier(const char* name, const char* value)
+  setFastTFBS(bool aFastTFBS)
   {
-    if (strcmp(name, "db_xref"))
-      return;
-
-    if (strncmp(value, "HGNC:", 5))
-      return;
+    mFastTFBS = aFastTFBS;
+  }
 
-    uint32_t hgncId = strtoul(value + 5, NULL, 10);
+  // Keeps the genes read from each chromosome in a sidecar in aCacheDir,
+  // and reads them from there instead while the chromosome is unchanged.
+  void
+  setGeneCache(const fs::path& aCacheDir)
+  {
+    mGeneCacheDir = aCacheDir;
+  }
 
-    // We now have a HGNC ID, a direction, and a start and end point.
-    // Convert this to a range...
+  // Keeps what each contig contributed in a sidecar per chromosome in
+  // aCacheDir, and replays it from there while the contig's inputs and the
+  // build parameters are unchanged.
+  void
+  setContigCache(const fs::path& aCacheDir)
+  {
+    mContigCacheDir = aCacheDir;
+  }
 
-    if (mComplement)
-      mReverseGenes.push_back(Gene(mGeneEnd, hgncId));
-    else
-      mForwardGenes.push_back(Gene(mGeneStart, hgncId));
+  // Selects between reading the chromosome files with the GeneExtractor,
+  // which skips the sequence, or with the general GenBank parser (the
+  // default).
+  void
+  setFastGenes(bool aFastGenes)
+  {
+    mFastGenes = aFastGenes;
   }
 
+  // Reads the BaSeTraM output of upcoming contigs ahead while the current
+  // one is processed, holding no more than aBudget bytes of it at a time,
+  // shared between the workers; 0 (the default) reads each as it comes.
   void
-  CodingData(const char* data)
+  setPrefetchBudget(uint64_t aBudget)
   {
+    mPrefetchBudget = aBudget;
   }
 
+  // Keeps aMetrics up to date with the progress of processChromosomes().
   void
-  dealWithContig()
+  setMetrics(BuildMetrics* aMetrics)
   {
-    if (mForwardGenes.size() == 0 && mReverseGenes.size() == 0)
-      return;
+    mMetrics = aMetrics;
+  }
 
-    std::sort(mForwardGenes.begin(), mForwardGenes.end());
-    std::sort(mReverseGenes.begin(), mReverseGenes.end());
+  void
+  generateOutput(std::ostream& aOutput, bool aBinary, uint32_t aNetwork = 0)
+  {
+    TraceScope trace("generateOutput", mNetworks[aNetwork].config.name());
+    Network& network(mNetworks[aNetwork]);
+
+    NetworkModel model;
+    std::map<uint32_t, std::string> snapshotNames;
+    network.buildModel(network.config.minRegs,
+                       vertexNames(network, snapshotNames), model);
+
+    std::ostringstream comments;
+    comments << "# There are " << model.edgeCount() << " edges" << std::endl
+             << "# " << network.tfbsProcessed
+             << " transcription factor binding sites processed."
+             << std::endl
+             << "# " << network.tfbsUnmapped
+             << " of them were for factors with no HGNC mapping."
+             << std::endl
+             << "# Total number of gene-TFBS region overlaps for mapped factors: "
+             << network.edgeCalls << "." << std::endl
+             << "# Average probability for TFBS assigned to genes: "
+             << (network.tfbsUsedProbs / network.tfbsUsed) << std::endl
+             << "# Average probability for TFBS not assigned to genes: "
+             << (network.tfbsUnusedProbs / network.tfbsUnused) << std::endl;
+    model.setComments(comments.str());
+
+    if (aBinary)
+      model.writeBinary(aOutput);
+    else
+      model.writeText(aOutput);
+  }
 
-    // Now we need to open the BaSeTraM output and start finding TFBSes...
-    TextSource* ts = NewBufferedFileSource(mContigFile.string().c_str());
-    mBTP->SetSource(ts);
-    try
+  bool
+  indexMatrices(const std::string& aPath)
+  {
+    TraceScope trace("indexMatrices", aPath);
+    MatrixIndexer indexer(*this);
+    MatrixScanner scanner;
+    std::string error;
+    if (!scanner.scanFile(aPath, indexer, error))
     {
-      mBTP->Parse();
+      std::cerr << error << std::endl;
+      return false;
     }
-    catch (const ParserException& pe)
+    return true;
+  }
+
+  bool
+  loadHGNCDatabase(const std::string& aPath, uint32_t aThreads = 1)
+  {
+    TraceScope trace("loadHGNCDatabase", aPath);
+    closeIndexSnapshot();
+    HGNCLoader loader;
+    std::string error;
+    if (!loader.load(aPath, aThreads, mHGNCIdMappings, mNameByHGNCId, error))
     {
-      std::cout << "Parse error: " << pe.what() << std::endl;
+      std::cerr << error << std::endl;
+      return false;
     }
-    mBTP->SetSource(NULL);
-    delete ts;
 
-    mForwardGenes.clear();
-    mReverseGenes.clear();
+    mResolver.compile(mHGNCIdMappings);
+    return true;
   }
 
-  void
-  processTFBS(bool isComplement, uint32_t start, uint32_t end,
-              std::string TRANSFAC, double probability)
+  bool
+  loadIndexSnapshot(const std::string& aSnapshot, const std::string& aHGNC,
+                    const std::string& aMatrices)
   {
-    if (probability < kMinProbability)
-      return;
+    TraceScope trace("loadIndexSnapshot", aSnapshot);
+    if (!fs::exists(aSnapshot))
+      return false;
+
+    io::mapped_file_source snapshot;
+    try
+    {
+      snapshot.open(aSnapshot);
+    }
+    catch (const std::exception& e)
+    {
+      std::cerr << "Cannot map index snapshot " << aSnapshot << ": "
+                << e.what() << std::endl;
+      return false;
+    }
+
+    const char* base = snapshot.data();
+    size_t size = snapshot.size();
+
+    IndexSnapshot::Header expected, header;
+    if (!IndexSnapshot::initHeader(expected, aHGNC, aMatrices) ||
+        size < sizeof(header))
+      return false;
+    memcpy(&header, base, sizeof(header));
+
+    if (memcmp(header.magic, expected.magic, sizeof(header.magic)) ||
+        header.version != expected.version ||
+        header.byteOrder != expected.byteOrder)
+    {
+      std::cerr << "Ignoring index snapshot " << aSnapshot
+                << " with an unrecognised format." << std::endl;
+      return false;
+    }
 
-    mTFBSProcessed++;
-    bool hadEdge = false;
+    if (header.hgncSize != expected.hgncSize ||
+        header.hgncMTime != expected.hgncMTime ||
+        header.matricesSize != expected.matricesSize ||
+        header.matricesMTime != expected.matricesMTime)
+      return false;
+
+    if (header.poolOffset > size || header.poolSize > size - header.poolOffset)
+      return false;
+    const char* pool = base + header.poolOffset;
+
+    if (header.resolverOffset > size ||
+        header.resolverSize > size - header.resolverOffset)
+      return false;
 
-    if (isComplement)
+    bool sound = true;
+    for (uint32_t t = 0; sound && t < IndexSnapshot::kTableCount; t++)
     {
-      size_t offset((start > kUpstreamZone) ? start - kUpstreamZone : 0);
-      std::vector<Gene>::iterator next
-        (std::upper_bound(mReverseGenes.begin(), mReverseGenes.end(),
-                          Gene(start + kDownstreamZone)));
+      const IndexSnapshot::Table& table(header.tables[t]);
+      uint64_t idsSize = table.count * sizeof(uint32_t);
+      uint64_t offsetsSize = (table.count + 1ULL) * sizeof(uint32_t);
+      if (table.idsOffset > size || idsSize > size - table.idsOffset ||
+          table.stringOffsetsOffset > size ||
+          offsetsSize > size - table.stringOffsetsOffset ||
+          table.idsOffset % sizeof(uint32_t) ||
+          table.stringOffsetsOffset % sizeof(uint32_t))
+        return false;
 
-      for (next--;
-           (next >= mReverseGenes.begin()) && (*next).offset >= offset;
-           next--)
-        hadEdge |= processEdge(TRANSFAC, (*next).hgncId);
+      const uint32_t* offsets =
+        reinterpret_cast<const uint32_t*>(base + table.stringOffsetsOffset);
+      for (uint32_t i = 0; sound && i < table.count; i++)
+        sound = offsets[i] <= offsets[i + 1] &&
+          offsets[i + 1] <= header.poolSize;
     }
-    else
+
+    if (!sound)
     {
-      size_t offset((start > kDownstreamZone) ? start - kDownstreamZone : 0);
-      std::vector<Gene>::iterator next
-        (std::upper_bound(mForwardGenes.begin(), mForwardGenes.end(),
-                          Gene(start + kUpstreamZone)));
+      std::cerr << "Index snapshot " << aSnapshot << " is corrupt."
+                << std::endl;
+      return false;
+    }
+
+    // Everything checks out, so throw away anything we already had. The
+    // HGNC tables stay in the mapping, where the names are looked up in
+    // place, and the resolver's table is only copied out of it if a name
+    // is resolved; only the factors, which are few, are interned one by
+    // one.
+    mHGNCIdMappings.clear();
+    mNameByHGNCId.clear();
+    mFactors.clear();
+    mHGNCByFactor.clear();
+    closeIndexSnapshot();
+
+    IndexSnapshot::TableView factors(base,
+                                     header.tables[IndexSnapshot::kHGNCByTRANSFAC],
+                                     pool);
+    for (uint32_t i = 0; i < factors.size(); i++)
+      addFactor(factors.string(i), factors.id(i));
+
+    mSnapshot = snapshot;
+    mSnapshotResolver = base + header.resolverOffset;
+    mSnapshotResolverSize = header.resolverSize;
+    mSnapshotIdByName =
+      IndexSnapshot::TableView(base, header.tables[IndexSnapshot::kHGNCIdByName],
+                               pool);
+    mSnapshotNameById =
+      IndexSnapshot::TableView(base, header.tables[IndexSnapshot::kNameByHGNCId],
+                               pool);
+    return true;
+  }
+
+  // Checks the compiled resolver against findHGNCIdByName() for every HGNC
+  // name and a spread of variants of each, reporting any disagreements.
+  // Returns the number found.
+  uint32_t
+  verifyResolver(std::ostream& aOutput)
+  {
+    static const char* const kOdd[] =
+    {
+      "", "-", "1", "-1", "12", "-12", "A", "ALPHA", "ALPHA1", "A-1-2",
+      "1\n2"
+    };
+
+    HGNCResolver& resolver(this->resolver());
+    loadSnapshotMappings();
+
+    std::vector<std::string> queries(kOdd, kOdd + sizeof(kOdd) / sizeof(kOdd[0]));
+    for
+    (
+     std::map<std::string, uint32_t>::iterator i = mHGNCIdMappings.begin();
+     i != mHGNCIdMappings.end();
+     i++
+    )
+    {
+      const std::string& name((*i).first);
+      queries.push_back(name);
+      queries.push_back(name + "1");
+      queries.push_back(name + "2");
+      queries.push_back(name + "-1");
+      queries.push_back(name + "-2");
+      queries.push_back(name + "12");
+      queries.push_back(name + "A");
+      queries.push_back(name + "-A");
+      queries.push_back(name + "ALPHA");
+      queries.push_back(name + "-ALPHA-3");
+      queries.push_back(name + "\n");
+      queries.push_back(name + "7\nX");
+      queries.push_back(name + "-7\rX");
+      queries.push_back(name + "7\fX");
+      queries.push_back(name + "7\tX");
+      queries.push_back(boost::algorithm::to_lower_copy(name));
+      if (name.size() > 1)
+      {
+        std::string dashed(name);
+        dashed.insert(name.size() / 2, "-");
+        queries.push_back(dashed);
+        queries.push_back(name.substr(0, name.size() - 1));
+        queries.push_back(name.substr(0, name.size() - 1) + "1");
+      }
+      std::string alpha(name);
+      size_t a = alpha.find('A');
+      if (a != std::string::npos)
+      {
+        alpha.replace(a, 1, "ALPHA");
+        queries.push_back(alpha);
+      }
+    }
+
+    // Ask about everything twice, so the remembered answers are checked too.
+    uint32_t mismatches = 0;
+    for (uint32_t pass = 0; pass < 2; pass++)
+    {
+      for (uint32_t q = 0; q < queries.size(); q++)
+      {
+        uint32_t expected = findHGNCIdByName(mHGNCIdMappings, queries[q]);
+        uint32_t actual = resolver.resolve(queries[q]);
+        if (expected == actual)
+          continue;
+        if (mismatches++ < 20)
+          aOutput << "Resolver mismatch for \"" << queries[q] << "\": "
+                  << actual << " instead of " << expected << std::endl;
+      }
+    }
+
+    aOutput << "Checked " << queries.size() << " names against "
+            << mHGNCIdMappings.size() << " HGNC entries: " << mismatches
+            << " mismatches." << std::endl;
+    return mismatches;
+  }
+
+  void
+  saveIndexSnapshot(const std::string& aSnapshot, const std::string& aHGNC,
+                    const std::string& aMatrices)
+  {
+    TraceScope trace("saveIndexSnapshot", aSnapshot);
+    IndexSnapshot::Header header;
+    if (!IndexSnapshot::initHeader(header, aHGNC, aMatrices))
+      return;
+
+    std::vector<uint32_t> ids[IndexSnapshot::kTableCount],
+      offsets[IndexSnapshot::kTableCount];
+    std::string pool;
+
+    for
+    (
+     std::map<std::string, uint32_t>::iterator i = mHGNCIdMappings.begin();
+     i != mHGNCIdMappings.end();
+     i++
+    )
+    {
+      offsets[IndexSnapshot::kHGNCIdByName].push_back(pool.size());
+      ids[IndexSnapshot::kHGNCIdByName].push_back((*i).second);
+      pool += (*i).first;
+    }
+    offsets[IndexSnapshot::kHGNCIdByName].push_back(pool.size());
+
+    std::map<std::string, uint32_t> factors;
+    for (uint32_t f = 0; f < mFactors.size(); f++)
+      factors.insert(std::pair<std::string, uint32_t>(mFactors.accession(f),
+                                                      mHGNCByFactor[f]));
+    for
+    (
+     std::map<std::string, uint32_t>::iterator i = factors.begin();
+     i != factors.end();
+     i++
+    )
+    {
+      offsets[IndexSnapshot::kHGNCByTRANSFAC].push_back(pool.size());
+      ids[IndexSnapshot::kHGNCByTRANSFAC].push_back((*i).second);
+      pool += (*i).first;
+    }
+    offsets[IndexSnapshot::kHGNCByTRANSFAC].push_back(pool.size());
+
+    for
+    (
+     std::map<uint32_t, std::string>::iterator i = mNameByHGNCId.begin();
+     i != mNameByHGNCId.end();
+     i++
+    )
+    {
+      offsets[IndexSnapshot::kNameByHGNCId].push_back(pool.size());
+      ids[IndexSnapshot::kNameByHGNCId].push_back((*i).first);
+      pool += (*i).second;
+    }
+    offsets[IndexSnapshot::kNameByHGNCId].push_back(pool.size());
+
+    uint64_t pos = sizeof(header);
+    for (uint32_t t = 0; t < IndexSnapshot::kTableCount; t++)
+    {
+      header.tables[t].count = ids[t].size();
+      header.tables[t].idsOffset = pos;
+      pos += ids[t].size() * sizeof(uint32_t);
+      header.tables[t].stringOffsetsOffset = pos;
+      pos += offsets[t].size() * sizeof(uint32_t);
+    }
+    header.poolOffset = pos;
+    header.poolSize = pool.size();
+    pos += pool.size();
+
+    std::string resolverBlock;
+    resolver().save(resolverBlock);
+    header.resolverOffset = pos;
+    header.resolverSize = resolverBlock.size();
+
+    // Write to a temporary of our own and rename it into place, so a
+    // concurrent run never maps a half-written snapshot.
+    std::string tmp(tempPathFor(aSnapshot));
+    {
+      std::ofstream out(tmp.c_str(), std::ios::binary | std::ios::trunc);
+      out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      for (uint32_t t = 0; t < IndexSnapshot::kTableCount; t++)
+      {
+        if (!ids[t].empty())
+          out.write(reinterpret_cast<const char*>(&ids[t][0]),
+                    ids[t].size() * sizeof(uint32_t));
+        out.write(reinterpret_cast<const char*>(&offsets[t][0]),
+                  offsets[t].size() * sizeof(uint32_t));
+      }
+      out.write(pool.data(), pool.size());
+      out.write(resolverBlock.data(), resolverBlock.size());
+
+      if (!out.good())
+      {
+        std::cerr << "Could not write index snapshot " << aSnapshot
+                  << std::endl;
+        out.close();
+        fs::remove(tmp);
+        return;
+      }
+    }
+    replaceWithTemp(tmp, aSnapshot);
+  }
+
+  void
+  processChromosomes(const std::vector<std::string>& aFiles,
+                     uint32_t aThreads, std::ostream& aMessages)
+  {
+    TraceScope trace("processChromosomes");
+    if (!mContigCacheDir.empty())
+      mContigParamsHash = contigParamsHash();
+
+    if (mMetrics)
+    {
+      uint64_t contigs = 0;
+      for (uint32_t i = 0; i < aFiles.size(); i++)
+        contigs += countContigFiles(mBaSeTraM / fs::basename(aFiles[i]));
+      mMetrics->addChromosomes(aFiles.size(), contigs);
+    }
+
+    mWorkerPrefetchBudget = mPrefetchBudget /
+      std::max<size_t>(std::min<size_t>(aThreads, aFiles.size()), 1);
+
+    if (aThreads <= 1)
+    {
+      ChromosomeWorker worker(*this);
+      for
+      (
+       std::vector<std::string>::const_iterator i = aFiles.begin();
+       i != aFiles.end();
+       i++
+      )
+      {
+        ChromosomeShard shard(mNetworks.size());
+        worker.processChromosome(*i, shard);
+        mergeShard(shard, aMessages);
+      }
+      return;
+    }
+
+    // Workers take chromosomes in turn off the list and fill in their
+    // shards; this thread merges the shards strictly in list order as they
+    // become available, so the result does not depend on the scheduling.
+    ChromosomeQueue queue(aFiles);
+    boost::thread_group workers;
+    for (uint32_t i = 0; i < aThreads && i < aFiles.size(); i++)
+      workers.create_thread(boost::bind(&TFNetBuilder::runWorker, this,
+                                        boost::ref(queue)));
+
+    for (size_t i = 0; i < aFiles.size(); i++)
+    {
+      ChromosomeShard* shard;
+      {
+        boost::mutex::scoped_lock lock(queue.mutex);
+        while (queue.shards[i] == NULL)
+          queue.shardDone.wait(lock);
+        shard = queue.shards[i];
+      }
+      mergeShard(*shard, aMessages);
+      delete shard;
+    }
+
+    workers.join_all();
+  }
+
+private:
+  // The number of BaSeTraM files for a chromosome, one for each contig.
+  static uint64_t
+  countContigFiles(const fs::path& aDir)
+  {
+    boost::system::error_code ec;
+    uint64_t files = 0;
+    for (fs::directory_iterator i(aDir, ec);
+         !ec && i != fs::directory_iterator();
+         i.increment(ec))
+      files++;
+    return files;
+  }
+
+  // The size of a file, or 0 if it cannot be looked at.
+  static uint64_t
+  fileSize(const fs::path& aPath)
+  {
+    boost::system::error_code ec;
+    uint64_t size = fs::file_size(aPath, ec);
+    return ec ? 0 : size;
+  }
+
+  // Everything accumulated for the network of one WindowConfig.
+  class Network
+    : public NetworkAccumulator
+  {
+  public:
+    Network(const WindowConfig& aConfig)
+      : config(aConfig), tfbsProcessed(0), edgeCalls(0), tfbsUsed(0),
+        tfbsUnused(0), tfbsUnmapped(0), tfbsUsedProbs(0.0),
+        tfbsUnusedProbs(0.0)
+    {
+    }
+
+    WindowConfig config;
+    uint32_t tfbsProcessed, edgeCalls, tfbsUsed, tfbsUnused, tfbsUnmapped;
+    double tfbsUsedProbs, tfbsUnusedProbs;
+  };
+
+  std::vector<Network> mNetworks;
+  fs::path mBaSeTraM;
+  bool mBatchSweep, mFastTFBS, mFastGenes;
+  fs::path mGeneCacheDir, mContigCacheDir;
+  uint64_t mContigParamsHash;
+  BuildMetrics* mMetrics;
+  uint64_t mPrefetchBudget, mWorkerPrefetchBudget;
+
+  // Forgets the HGNC tables of any index snapshot loaded before.
+  void
+  closeIndexSnapshot()
+  {
+    mSnapshotIdByName = IndexSnapshot::TableView();
+    mSnapshotNameById = IndexSnapshot::TableView();
+    mSnapshotResolver = NULL;
+    mSnapshotResolverSize = 0;
+    mSnapshot.close();
+  }
+
+  // Fills mHGNCIdMappings from the index snapshot's table, for what needs
+  // the names in a map.
+  void
+  loadSnapshotMappings()
+  {
+    if (!mHGNCIdMappings.empty())
+      return;
+    for (uint32_t i = 0; i < mSnapshotIdByName.size(); i++)
+      mHGNCIdMappings.insert(mHGNCIdMappings.end(),
+                             std::pair<std::string, uint32_t>
+                             (mSnapshotIdByName.string(i),
+                              mSnapshotIdByName.id(i)));
+  }
+
+  // The resolver, copied out of the index snapshot the first time it is
+  // wanted after one was loaded. If the snapshot's copy does not hold
+  // together, it is compiled afresh from the snapshot's names.
+  HGNCResolver&
+  resolver()
+  {
+    if (mSnapshotResolver)
+    {
+      if (!mResolver.load(mSnapshotResolver, mSnapshotResolverSize))
+      {
+        std::cerr << "Index snapshot resolver table is corrupt; compiling it "
+                  << "again." << std::endl;
+        loadSnapshotMappings();
+        mResolver.compile(mHGNCIdMappings);
+      }
+      mSnapshotResolver = NULL;
+    }
+    return mResolver;
+  }
+
+  // The names for a network's vertices: all of mNameByHGNCId, or, with the
+  // HGNC tables left in the index snapshot, just the ones the network will
+  // keep, looked up there into aScratch.
+  const std::map<uint32_t, std::string>&
+  vertexNames(const Network& aNetwork,
+              std::map<uint32_t, std::string>& aScratch) const
+  {
+    if (mSnapshotNameById.size() == 0)
+      return mNameByHGNCId;
+
+    for
+    (
+     std::map<uint32_t, uint32_t>::const_iterator i =
+       aNetwork.usedHGNCIds.begin();
+     i != aNetwork.usedHGNCIds.end();
+     i++
+    )
+    {
+      std::string name;
+      if ((*i).second >= aNetwork.config.minRegs &&
+          mSnapshotNameById.findById((*i).first, name))
+        aScratch.insert(aScratch.end(),
+                        std::pair<uint32_t, std::string>((*i).first, name));
+    }
+    return aScratch;
+  }
+
+  // Covers everything besides a contig's own inputs that decides what it
+  // contributes: the window configurations and the factor index.
+  uint64_t
+  contigParamsHash() const
+  {
+    uint64_t h = ContigCache::kHashSeed;
+    for (uint32_t n = 0; n < mNetworks.size(); n++)
+    {
+      const WindowConfig& config(mNetworks[n].config);
+      h = ContigCache::hash(h, &config.upstream, sizeof(config.upstream));
+      h = ContigCache::hash(h, &config.downstream, sizeof(config.downstream));
+      h = ContigCache::hash(h, &config.minProbability,
+                            sizeof(config.minProbability));
+    }
+    for (uint32_t f = 0; f < mFactors.size(); f++)
+    {
+      std::string accession(mFactors.accession(f));
+      h = ContigCache::hash(h, accession.c_str(), accession.size() + 1);
+      h = ContigCache::hash(h, &mHGNCByFactor[f], sizeof(uint32_t));
+    }
+    return h;
+  }
+
+  std::map<std::string, uint32_t> mHGNCIdMappings;
+  std::map<uint32_t, std::string> mNameByHGNCId;
+  // After loadIndexSnapshot(), the two maps above are left empty and these
+  // look into the mapping instead.
+  io::mapped_file_source mSnapshot;
+  IndexSnapshot::TableView mSnapshotIdByName, mSnapshotNameById;
+  const char* mSnapshotResolver;
+  uint64_t mSnapshotResolverSize;
+  HGNCResolver mResolver;
+  // Only accessions with an HGNC mapping are interned, so every factor ID
+  // has an entry here.
+  FactorTable mFactors;
+  std::vector<uint32_t> mHGNCByFactor;
+
+  // Collects the factor names given for each matrix in matrix.dat, and maps
+  // the matrix's accession to each one that resolves to an HGNC ID.
+  class MatrixIndexer
+    : public MatrixScanSink
+  {
+  public:
+    MatrixIndexer(TFNetBuilder& aBuilder)
+      : mBuilder(aBuilder), mSeenAC(false)
+    {
+    }
+
+    void
+    Accession(const char* aAccession, size_t aLength)
+    {
+      mAC.assign(aAccession, aLength);
+      mSeenAC = true;
+    }
+
+    void
+    FactorName(const char* aName, size_t aLength)
+    {
+      mBF.insert(cleanupHGNCName(std::string(aName, aLength)));
+    }
+
+    void
+    EndEntry()
+    {
+      if (mBF.size() && mSeenAC)
+      {
+        for
+        (
+         std::set<std::string>::iterator j(mBF.begin());
+         j != mBF.end();
+         j++
+        )
+        {
+          uint32_t id(mBuilder.resolver().resolve(*j));
+          if (id != 0)
+            mBuilder.addFactor(mAC, id);
+        }
+      }
+      mSeenAC = false;
+      mBF.clear();
+    }
+
+  private:
+    TFNetBuilder& mBuilder;
+    bool mSeenAC;
+    std::string mAC;
+    std::set<std::string> mBF;
+  };
+
+  // The first mapping found for an accession wins.
+  void addFactor(const std::string& aAccession, uint32_t aHGNC)
+  {
+    bool added;
+    mFactors.intern(aAccession, added);
+    if (added)
+      mHGNCByFactor.push_back(aHGNC);
+  }
+
+  // Everything one chromosome contributes to the network. Workers fill
+  // these in independently; mergeShard() then replays them through
+  // processEdge() in the order the chromosomes were listed, so the
+  // kMaxRegulated cap, the usage counts and the probability sums all come
+  // out exactly as they would from a serial run.
+  class NetworkShard
+  {
+  public:
+    NetworkShard()
+      : tfbsProcessed(0), edgeCalls(0), unmappedSites(0)
+    {
+    }
+
+    uint32_t tfbsProcessed, edgeCalls, unmappedSites;
+    // One entry per TFBS over the minimum probability, in the order they
+    // were seen: its probability, and how many of the following (target,
+    // source) pairs in edges it produced.
+    std::vector<std::pair<double, uint32_t> > sites;
+    std::vector<std::pair<uint32_t, uint32_t> > edges;
+  };
+
+  class ChromosomeShard
+  {
+  public:
+    ChromosomeShard(uint32_t aNetworks)
+      : networks(aNetworks)
+    {
+    }
+
+    // One for each of the builder's networks.
+    std::vector<NetworkShard> networks;
+    // Parse errors, to be reported when the shard is merged.
+    std::string messages;
+  };
+
+  class ChromosomeQueue
+  {
+  public:
+    ChromosomeQueue(const std::vector<std::string>& aFiles)
+      : files(aFiles), next(0), shards(aFiles.size(), NULL)
+    {
+    }
+
+    const std::vector<std::string>& files;
+    size_t next;
+    std::vector<ChromosomeShard*> shards;
+    boost::mutex mutex;
+    boost::condition_variable shardDone;
+  };
+
+  // Owns its own parsers and gene vectors, so one of these can run on each
+  // thread. It only reads from the builder (the factor index).
+  class ChromosomeWorker
+    : public GenBankSink
+  {
+    // How far a network's shard had got when a contig started.
+    class ContigMark
+    {
+    public:
+      ContigMark(const NetworkShard& aShard)
+        : tfbsProcessed(aShard.tfbsProcessed), edgeCalls(aShard.edgeCalls),
+          unmappedSites(aShard.unmappedSites), sites(aShard.sites.size()),
+          edges(aShard.edges.size())
+      {
+      }
+
+      uint32_t tfbsProcessed, edgeCalls, unmappedSites;
+      size_t sites, edges;
+    };
+
+  public:
+    ChromosomeWorker(const TFNetBuilder& aBuilder)
+      : mBuilder(aBuilder), mGBP(NewGenBankParser()),
+        mBTP(NewGenBankParser()), mComplement(false), mRecordContigs(false),
+        mCachingContigs(false), mShard(NULL), mContigsDone(0),
+        mTFBSSink(this)
+    {
+      mGBP->SetSink(this);
+      mBTP->SetSink(&mTFBSSink);
+      if (aBuilder.mWorkerPrefetchBudget)
+        mPrefetcher.start(aBuilder.mWorkerPrefetchBudget, aBuilder.mFastTFBS);
+
+      mMinProbability = aBuilder.mNetworks[0].config.minProbability;
+      for (uint32_t n = 1; n < aBuilder.mNetworks.size(); n++)
+        mMinProbability = std::min(mMinProbability,
+                                   aBuilder.mNetworks[n].config.minProbability);
+    }
+
+    ~ChromosomeWorker()
+    {
+      delete mGBP;
+      delete mBTP;
+    }
+
+    void
+    processChromosome(const std::string& aFile, ChromosomeShard& aShard)
+    {
+      TraceScope trace("processChromosome", aFile);
+      mShard = &aShard;
+      mContigsDone = 0;
+
+      mChromosomeDir = mBuilder.mBaSeTraM;
+      mChromosomeDir /= fs::basename(aFile);
+
+      mCachingContigs = !mBuilder.mContigCacheDir.empty();
+      if (mCachingContigs)
+        openContigCache(aFile);
+
+      GeneCache::Header cacheKey;
+      bool caching = !mBuilder.mGeneCacheDir.empty() &&
+        GeneCache::initHeader(cacheKey, aFile);
+      uint64_t bytes = 0;
+      if (!caching || !loadGeneCache(aFile, cacheKey))
+      {
+        mRecordContigs = caching;
+        prefetchContigs(aFile);
+        bool complete = readGenes(aFile);
+        dealWithContig();
+        if (mBuilder.mMetrics)
+          bytes = fileSize(aFile);
+
+        if (caching && complete)
+          saveGeneCache(aFile, cacheKey);
+        mRecordContigs = false;
+        mCachedContigs.clear();
+      }
+
+      mPrefetcher.clear();
+      if (mCachingContigs)
+        saveContigCache(aFile);
+      mCachingContigs = false;
+
+      if (mBuilder.mMetrics)
+      {
+        uint64_t files = countContigFiles(mChromosomeDir);
+        mBuilder.mMetrics->chromosomeDone(files > mContigsDone ?
+                                          files - mContigsDone : 0, bytes);
+      }
+
+      mShard = NULL;
+    }
+
+    // Reads the genes of each contig in the chromosome, processing each
+    // contig as the next one starts. Returns false if the file could not be
+    // read in full.
+    bool
+    readGenes(const std::string& aFile)
+    {
+      TraceScope trace("readGenes", aFile);
+      if (mBuilder.mFastGenes)
+      {
+        std::string error;
+        if (mGeneExtractor.extractFile(aFile, *this, error))
+          return true;
+
+        mShard->messages += "Parse error: " + error + "\n";
+        return false;
+      }
+
+      bool complete = true;
+      try
+      {
+        TextSource* ts = NewBufferedFileSource(aFile.c_str());
+        mGBP->SetSource(ts);
+
+        try
+        {
+          mGBP->Parse();
+        }
+        catch (ParserException& pe)
+        {
+          mShard->messages += std::string("Parse error: ") + pe.what() + "\n";
+          complete = false;
+        }
+
+        mGBP->SetSource(NULL);
+        delete ts;
+      }
+      catch (const ParserException& pe)
+      {
+        mShard->messages += std::string("Parser error: ") + pe.what() + "\n";
+        complete = false;
+      }
+
+      return complete;
+    }
+
+    // Processes every contig from the chromosome's gene cache sidecar, if
+    // it is there and matches aKey. Nothing is processed unless the whole
+    // sidecar checks out.
+    bool
+    loadGeneCache(const std::string& aFile, const GeneCache::Header& aKey)
+    {
+      fs::path path(GeneCache::sidecarPath(mBuilder.mGeneCacheDir, aFile));
+      if (!fs::exists(path))
+        return false;
+
+      io::mapped_file_source sidecar;
+      try
+      {
+        sidecar.open(path);
+      }
+      catch (const std::exception& e)
+      {
+        return false;
+      }
+
+      const char* base = sidecar.data();
+      size_t size = sidecar.size();
+      GeneCache::Header header;
+      if (size < sizeof(header))
+        return false;
+      memcpy(&header, base, sizeof(header));
+
+      if (memcmp(header.magic, aKey.magic, sizeof(header.magic)) ||
+          header.version != aKey.version ||
+          header.byteOrder != aKey.byteOrder ||
+          header.sourceSize != aKey.sourceSize ||
+          header.sourceMTime != aKey.sourceMTime ||
+          header.sourceHash != aKey.sourceHash)
+        return false;
+
+      std::vector<size_t> contigs;
+      size_t pos = sizeof(header);
+      for (uint32_t c = 0; c < header.contigCount; c++)
+      {
+        GeneCache::ContigHeader contig;
+        if (size - pos < sizeof(contig))
+          return false;
+        memcpy(&contig, base + pos, sizeof(contig));
+
+        uint64_t length = sizeof(contig) + ((contig.nameLength + 3ULL) & ~3ULL) +
+          (static_cast<uint64_t>(contig.forwardCount) + contig.reverseCount) *
+          2 * sizeof(uint32_t);
+        if (size - pos < length)
+          return false;
+
+        contigs.push_back(pos);
+        pos += length;
+      }
+
+      for (uint32_t c = 0; c < contigs.size(); c++)
+      {
+        GeneCache::ContigHeader contig;
+        memcpy(&contig, base + contigs[c], sizeof(contig));
+        prefetchContig(mChromosomeDir /
+                       std::string(base + contigs[c] + sizeof(contig),
+                                   contig.nameLength));
+      }
+
+      for (uint32_t c = 0; c < contigs.size(); c++)
+      {
+        GeneCache::ContigHeader contig;
+        memcpy(&contig, base + contigs[c], sizeof(contig));
+        const char* name = base + contigs[c] + sizeof(contig);
+        const uint32_t* genes = reinterpret_cast<const uint32_t*>
+          (name + ((contig.nameLength + 3) & ~3U));
+
+        mContigFile = mChromosomeDir / std::string(name, contig.nameLength);
+        for (uint32_t i = 0; i < contig.forwardCount; i++, genes += 2)
+          mForwardGenes.push_back(Gene(genes[0], genes[1]));
+        for (uint32_t i = 0; i < contig.reverseCount; i++, genes += 2)
+          mReverseGenes.push_back(Gene(genes[0], genes[1]));
+
+        processContig();
+      }
+
+      return true;
+    }
+
+    void
+    saveGeneCache(const std::string& aFile, GeneCache::Header& aKey)
+    {
+      fs::path path(GeneCache::sidecarPath(mBuilder.mGeneCacheDir, aFile));
+      aKey.contigCount = mCachedContigs.size();
+
+      // Write to a temporary of our own and rename it into place, so a
+      // concurrent run never maps a half-written sidecar.
+      fs::path tmp(tempPathFor(path.string()));
+      {
+        std::ofstream out(tmp.string().c_str(),
+                          std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&aKey), sizeof(aKey));
+        for
+        (
+         std::vector<CachedContig>::iterator i = mCachedContigs.begin();
+         i != mCachedContigs.end();
+         i++
+        )
+        {
+          GeneCache::ContigHeader contig;
+          memset(&contig, 0, sizeof(contig));
+          contig.nameLength = (*i).name.size();
+          contig.forwardCount = (*i).forward.size();
+          contig.reverseCount = (*i).reverse.size();
+          out.write(reinterpret_cast<const char*>(&contig), sizeof(contig));
+
+          std::string name((*i).name);
+          name.resize((name.size() + 3) & ~3U, '\0');
+          out.write(name.data(), name.size());
+
+          writeGenes(out, (*i).forward);
+          writeGenes(out, (*i).reverse);
+        }
+
+        if (!out.good())
+        {
+          std::cerr << "Could not write gene cache " << path.string()
+                    << std::endl;
+          out.close();
+          fs::remove(tmp);
+          return;
+        }
+      }
+      replaceWithTemp(tmp.string(), path.string());
+    }
+
+    static void
+    writeGenes(std::ostream& aOut, const std::vector<Gene>& aGenes)
+    {
+      for (uint32_t i = 0; i < aGenes.size(); i++)
+      {
+        uint32_t gene[2] = { aGenes[i].offset, aGenes[i].hgncId };
+        aOut.write(reinterpret_cast<const char*>(gene), sizeof(gene));
+      }
+    }
+
+    void
+    OpenKeyword(const char* name, const char* value)
+    {
+      if (!::strcmp(name, "LOCUS"))
+      {
+        dealWithContig();
+
+        mContigFile = mChromosomeDir;
+
+        std::string locus(value);
+        size_t pos = locus.find(" ");
+        mContigFile /= locus.substr(0, pos);
+      }
+    }
+
+    // Starts reading a contig's BaSeTraM output ahead, unless the contig
+    // cache is in use: most contigs are replayed from it then, and which
+    // ones is not known until their genes are in.
+    void
+    prefetchContig(const fs::path& aContigFile)
+    {
+      if (!mCachingContigs)
+        mPrefetcher.request(aContigFile.string());
+    }
+
+    // Queues every contig of the chromosome for reading ahead before its
+    // genes are read, so the budget, not the parse, decides how far ahead
+    // the reads get. The contigs are found from the LOCUS lines alone.
+    void
+    prefetchContigs(const std::string& aFile)
+    {
+      if (!mPrefetcher.running() || mCachingContigs)
+        return;
+
+      std::vector<std::string> names;
+      std::string error;
+      if (!GeneExtractor::locusNames(aFile, names, error))
+        return;
+      for (uint32_t i = 0; i < names.size(); i++)
+        prefetchContig(mChromosomeDir / names[i]);
+    }
+
+    void
+    CloseKeyword()
+    {
+    }
+
+    void
+    OpenFeature(const char* name, const char* location)
+    {
+      if (!::strcmp(name, "gene"))
+      {
+        if (!::strncmp(location, "complement(", 11))
+        {
+          mComplement = true;
+          location += 11;
+        }
+        else
+          mComplement = false;
+
+        mGeneStart = strtoul(location, NULL, 10);
+
+        location = strchr(location, '.');
+        if (location == NULL)
+          return;
+        location += 2;
+
+        mGeneEnd = strtoul(location, NULL, 10);
+      }
+    }
+
+    void
+    CloseFeature()
+    {
+    }
+
+    void
+    Qualifier(const char* name, const char* value)
+    {
+      if (strcmp(name, "db_xref"))
+        return;
+
+      if (strncmp(value, "HGNC:", 5))
+        return;
+
+      uint32_t hgncId = strtoul(value + 5, NULL, 10);
+
+      // We now have a HGNC ID, a direction, and a start and end point.
+      // Convert this to a range...
 
-      for (next--;
-           (next >= mForwardGenes.begin()) && (*next).offset >= offset;
-           next--)
-        hadEdge |= processEdge(TRANSFAC, (*next).hgncId);
+      if (mComplement)
+        mReverseGenes.push_back(Gene(mGeneEnd, hgncId));
+      else
+        mForwardGenes.push_back(Gene(mGeneStart, hgncId));
     }
 
-    if (hadEdge)
+    void
+    CodingData(const char* data)
     {
-      mTFBSUsed++;
-      mTFBSUsedProbs += probability;
     }
-    else
+
+    void
+    dealWithContig()
     {
-      mTFBSUnused++;
-      mTFBSUnusedProbs += probability;
-    }
-  }
+      if (mForwardGenes.size() == 0 && mReverseGenes.size() == 0)
+        return;
 
-private:
-  uint32_t mTFBSProcessed, mEdgeCalls, mTFBSUsed, mTFBSUnused;
-  double mTFBSUsedProbs, mTFBSUnusedProbs;
-  static const uint32_t kUpstreamZone = 15000, kDownstreamZone = 1000, kMinRegs = 1;
-  static const uint32_t kMaxRegulated = 3500;
-  uint32_t nRegulated;
-  static const double kMinProbability = 0.5;
-  fs::path mBaSeTraM, mChromosomeDir, mContigFile;
-  GenBankParser* mGBP, * mBTP;
-  bool mComplement;
-  uint32_t mGeneStart, mGeneEnd;
-  std::vector<Gene> mForwardGenes, mReverseGenes;
-
-  std::map<std::string, uint32_t> mHGNCIdMappings, mHGNCByTRANSFAC;
-  std::map<uint32_t, std::string> mNameByHGNCId;
+      std::sort(mForwardGenes.begin(), mForwardGenes.end());
+      std::sort(mReverseGenes.begin(), mReverseGenes.end());
 
-  void addHGNCMapping(const std::string& aMapping, uint32_t aHGNC,
-                      bool aOverride)
-  {
-    std::string dcmapping(cleanup_HGNC_name(aMapping));
+      // The genes are cached as sorted here: sorting them again on the way
+      // back in could reorder genes at the same offset.
+      if (mRecordContigs)
+        mCachedContigs.push_back(CachedContig(mContigFile.filename().string(),
+                                              mForwardGenes, mReverseGenes));
 
-    if (aOverride)
-      mNameByHGNCId.insert(std::pair<uint32_t, std::string>(aHGNC, aMapping));
+      processContig();
+    }
 
-    std::map<std::string, uint32_t>::iterator i =
-      mHGNCIdMappings.find(dcmapping);
-    if (i != mHGNCIdMappings.end())
+    // Adds the current contig's contribution to the shard, replaying it from
+    // the contig cache if it is there, and clears its genes.
+    void
+    processContig()
     {
-      if (!aOverride)
+      TraceScope trace("processContig", mContigFile.string());
+      const NetworkShard& counted(mShard->networks[0]);
+      uint32_t tfbsProcessed = counted.tfbsProcessed;
+      uint32_t edgeCalls = counted.edgeCalls;
+      mContigsDone++;
+
+      uint64_t key;
+      bool cacheable = mCachingContigs && contigKey(key);
+      if (cacheable && replayContig(key))
+      {
+        mForwardGenes.clear();
+        mReverseGenes.clear();
+        if (mBuilder.mMetrics)
+          mBuilder.mMetrics->contigDone(counted.tfbsProcessed - tfbsProcessed,
+                                        counted.edgeCalls - edgeCalls, 0);
         return;
+      }
 
-      mHGNCIdMappings.erase(i);
-    }
+      size_t messages = mShard->messages.size();
+      std::vector<ContigMark> marks;
+      for (uint32_t n = 0; cacheable && n < mShard->networks.size(); n++)
+        marks.push_back(ContigMark(mShard->networks[n]));
 
-    mHGNCIdMappings.insert(std::pair<std::string, uint32_t>
-                           (dcmapping, aHGNC));
-  }
+      scanContig();
 
-  bool processEdge(const std::string& aTRANSFAC, uint32_t aTargetHGNC)
-  {
-    mEdgeCalls++;
+      // A contig that reported errors is processed again next time, so the
+      // errors are reported again too.
+      if (cacheable && mShard->messages.size() == messages)
+        recordContig(key, marks);
 
-    std::map<std::string, uint32_t>::iterator i
-      (mHGNCByTRANSFAC.find(aTRANSFAC));
-    if (i == mHGNCByTRANSFAC.end())
+      if (mBuilder.mMetrics)
+        mBuilder.mMetrics->contigDone(counted.tfbsProcessed - tfbsProcessed,
+                                      counted.edgeCalls - edgeCalls,
+                                      fileSize(mContigFile));
+    }
+
+    // Hashes everything the current contig's contribution depends on, other
+    // than the build parameters: its name and genes, its BaSeTraM output,
+    // and the state the TFBS reader carries into it. Returns false if the
+    // BaSeTraM output cannot be looked at.
+    bool
+    contigKey(uint64_t& aKey)
     {
-      return false;
+      boost::system::error_code ec;
+      uint64_t size = fs::file_size(mContigFile, ec);
+      if (ec)
+        return false;
+      int64_t mtime = fs::last_write_time(mContigFile, ec);
+      if (ec)
+        return false;
+
+      uint32_t factor;
+      double probability;
+      mTFBSSink.state(factor, probability);
+
+      std::string name(mContigFile.filename().string());
+      uint64_t h = ContigCache::hash(mBuilder.mContigParamsHash, name.c_str(),
+                                     name.size() + 1);
+      h = ContigCache::hash(h, &size, sizeof(size));
+      h = ContigCache::hash(h, &mtime, sizeof(mtime));
+      h = ContigCache::hash(h, &factor, sizeof(factor));
+      h = ContigCache::hash(h, &probability, sizeof(probability));
+      uint32_t counts[2] = { static_cast<uint32_t>(mForwardGenes.size()),
+                             static_cast<uint32_t>(mReverseGenes.size()) };
+      h = ContigCache::hash(h, counts, sizeof(counts));
+      for (uint32_t i = 0; i < mForwardGenes.size(); i++)
+      {
+        h = ContigCache::hash(h, &mForwardGenes[i].offset, sizeof(uint32_t));
+        h = ContigCache::hash(h, &mForwardGenes[i].hgncId, sizeof(uint32_t));
+      }
+      for (uint32_t i = 0; i < mReverseGenes.size(); i++)
+      {
+        h = ContigCache::hash(h, &mReverseGenes[i].offset, sizeof(uint32_t));
+        h = ContigCache::hash(h, &mReverseGenes[i].hgncId, sizeof(uint32_t));
+      }
+
+      aKey = h;
+      return true;
     }
 
-    uint32_t sourceHGNC = (*i).second;
+    // Indexes the chromosome's contig cache sidecar, if there is one for the
+    // same build parameters. Any inconsistency discards the whole sidecar.
+    void
+    openContigCache(const std::string& aFile)
+    {
+      ContigCache::initHeader(mNewContigsHeader, mBuilder.mContigParamsHash,
+                              mBuilder.mNetworks.size());
+      mNewContigs.clear();
+      mOldContigIndex.clear();
+      mOldContigCount = 0;
+      mContigsChanged = false;
+      if (mOldContigs.is_open())
+        mOldContigs.close();
+
+      fs::path path(ContigCache::sidecarPath(mBuilder.mContigCacheDir, aFile));
+      if (!fs::exists(path))
+        return;
+      try
+      {
+        mOldContigs.open(path);
+      }
+      catch (const std::exception& e)
+      {
+        return;
+      }
+
+      const char* base = mOldContigs.data();
+      size_t size = mOldContigs.size();
+      ContigCache::Header header;
+      if (size < sizeof(header))
+        return;
+      memcpy(&header, base, sizeof(header));
+      if (memcmp(&header, &mNewContigsHeader,
+                 offsetof(ContigCache::Header, contigCount)))
+        return;
+
+      size_t pos = sizeof(header);
+      for (uint32_t c = 0; c < header.contigCount; c++)
+      {
+        size_t start = pos;
+        ContigCache::ContigHeader contig;
+        if (size - pos < sizeof(contig))
+          break;
+        memcpy(&contig, base + pos, sizeof(contig));
+        pos += sizeof(contig);
+        if (size - pos < contig.nameLength)
+          break;
+        std::string name(base + pos, contig.nameLength);
+        pos += contig.nameLength;
+
+        uint32_t n = 0;
+        for (; n < header.networkCount; n++)
+        {
+          ContigCache::NetworkHeader network;
+          if (size - pos < sizeof(network))
+            break;
+          memcpy(&network, base + pos, sizeof(network));
+          pos += sizeof(network);
+
+          uint64_t length = network.siteCount *
+            static_cast<uint64_t>(sizeof(double) + sizeof(uint32_t)) +
+            network.edgeCount * 2 * sizeof(uint32_t);
+          if (size - pos < length)
+            break;
+          pos += length;
+        }
+        if (n < header.networkCount)
+          break;
 
-    // We now have a source and target HGNC id... Just add them to the
-    // edge set for now, and also mark the source and target as used.
+        mOldContigIndex[name] =
+          std::pair<const char*, size_t>(base + start, pos - start);
+      }
 
-    std::map<uint32_t, uint32_t>::iterator j;
-    if ((j = mUsedHGNCIds.find(aTargetHGNC)) != mUsedHGNCIds.end())
-      (*j).second++;
-    else
+      if (pos != size)
+        mOldContigIndex.clear();
+      else
+        mOldContigCount = header.contigCount;
+    }
+
+    // Adds the current contig's cached contribution to the shard, if the
+    // cache has one under aKey.
+    bool
+    replayContig(uint64_t aKey)
     {
-      if (nRegulated++ > kMaxRegulated)
+      std::map<std::string, std::pair<const char*, size_t> >::iterator i =
+        mOldContigIndex.find(mContigFile.filename().string());
+      if (i == mOldContigIndex.end())
         return false;
-      mUsedHGNCIds.insert(std::pair<uint32_t, uint32_t>(aTargetHGNC, 1));
-    }
 
-    // The edge set for the source is set to 1000, which is a special to
-    // guarantee it is included.
-    mUsedHGNCIds[sourceHGNC] = 1000;
+      const char* p = (*i).second.first;
+      ContigCache::ContigHeader contig;
+      memcpy(&contig, p, sizeof(contig));
+      if (contig.key != aKey)
+        return false;
+      p += sizeof(contig) + contig.nameLength;
 
-    mEdges.insert(std::pair<uint32_t, uint32_t>(aTargetHGNC, sourceHGNC));
+      for (uint32_t n = 0; n < mShard->networks.size(); n++)
+      {
+        NetworkShard& shard(mShard->networks[n]);
+        ContigCache::NetworkHeader network;
+        memcpy(&network, p, sizeof(network));
+        p += sizeof(network);
 
-    return true;
-  }
+        shard.tfbsProcessed += network.tfbsProcessed;
+        shard.edgeCalls += network.edgeCalls;
+        shard.unmappedSites += network.unmappedSites;
 
-  std::string
-  cleanup_HGNC_name(const std::string& aName)
-  {
-    std::string uc(boost::algorithm::to_upper_copy(aName));
-    boost::algorithm::replace_all(uc, "-", "");
+        const char* counts = p + network.siteCount * sizeof(double);
+        for (uint32_t s = 0; s < network.siteCount; s++)
+        {
+          std::pair<double, uint32_t> site;
+          memcpy(&site.first, p + s * sizeof(double), sizeof(double));
+          memcpy(&site.second, counts + s * sizeof(uint32_t), sizeof(uint32_t));
+          shard.sites.push_back(site);
+        }
+        p = counts + network.siteCount * sizeof(uint32_t);
 
-    return uc;
-  }
+        for (uint64_t e = 0; e < network.edgeCount; e++, p += 8)
+        {
+          uint32_t edge[2];
+          memcpy(edge, p, sizeof(edge));
+          shard.edges.push_back(std::pair<uint32_t, uint32_t>(edge[0],
+                                                              edge[1]));
+        }
+      }
 
-  std::map<uint32_t, uint32_t> mUsedHGNCIds;
-  std::set<std::pair<uint32_t, uint32_t> > mEdges;
+      mTFBSSink.setState(contig.exitFactor, contig.exitProbability);
 
-  class TFBSSink
-    : public GenBankSink
-  {
-  public:
-    TFBSSink(TFNetBuilder* aTFBuilder)
-      : mTFBuilder(aTFBuilder)
-    {
+      mNewContigs.append((*i).second.first, (*i).second.second);
+      mNewContigsHeader.contigCount++;
+      return true;
     }
 
+    // Adds what the current contig has just contributed to the shard,
+    // since marks were taken, to the new contig cache.
     void
-    OpenKeyword(const char* name, const char* value)
-    {
-    }
-    
-    void
-    CloseKeyword()
+    recordContig(uint64_t aKey, const std::vector<ContigMark>& aMarks)
     {
+      ContigCache::ContigHeader contig;
+      memset(&contig, 0, sizeof(contig));
+      std::string name(mContigFile.filename().string());
+      contig.key = aKey;
+      contig.nameLength = name.size();
+      mTFBSSink.state(contig.exitFactor, contig.exitProbability);
+      mNewContigs.append(reinterpret_cast<const char*>(&contig),
+                         sizeof(contig));
+      mNewContigs += name;
+      mContigsChanged = true;
+
+      for (uint32_t n = 0; n < mShard->networks.size(); n++)
+      {
+        const NetworkShard& shard(mShard->networks[n]);
+        const ContigMark& mark(aMarks[n]);
+        ContigCache::NetworkHeader network;
+        memset(&network, 0, sizeof(network));
+        network.tfbsProcessed = shard.tfbsProcessed - mark.tfbsProcessed;
+        network.edgeCalls = shard.edgeCalls - mark.edgeCalls;
+        network.unmappedSites = shard.unmappedSites - mark.unmappedSites;
+        network.siteCount = shard.sites.size() - mark.sites;
+        network.edgeCount = shard.edges.size() - mark.edges;
+        mNewContigs.append(reinterpret_cast<const char*>(&network),
+                           sizeof(network));
+
+        for (size_t s = mark.sites; s < shard.sites.size(); s++)
+          mNewContigs.append(reinterpret_cast<const char*>
+                             (&shard.sites[s].first), sizeof(double));
+        for (size_t s = mark.sites; s < shard.sites.size(); s++)
+          mNewContigs.append(reinterpret_cast<const char*>
+                             (&shard.sites[s].second), sizeof(uint32_t));
+        for (size_t e = mark.edges; e < shard.edges.size(); e++)
+        {
+          uint32_t edge[2] = { shard.edges[e].first, shard.edges[e].second };
+          mNewContigs.append(reinterpret_cast<const char*>(edge),
+                             sizeof(edge));
+        }
+      }
+
+      mNewContigsHeader.contigCount++;
     }
-    
+
+    // Replaces the chromosome's contig cache sidecar with the contigs seen
+    // this time, unless they all came from it.
     void
-    OpenFeature(const char* name, const char* location)
+    saveContigCache(const std::string& aFile)
     {
-      if (strcmp(name, "TFBS"))
+      mOldContigIndex.clear();
+      if (mOldContigs.is_open())
+        mOldContigs.close();
+      if (!mContigsChanged &&
+          mNewContigsHeader.contigCount == mOldContigCount)
       {
-        mInTFBS = false;
+        mNewContigs.clear();
         return;
       }
 
-      mInTFBS = true;
+      // Runs with other parameters write other contents here, so each
+      // writes its own temporary before renaming it into place.
+      fs::path path(ContigCache::sidecarPath(mBuilder.mContigCacheDir, aFile));
+      fs::path tmp(tempPathFor(path.string()));
+      {
+        std::ofstream out(tmp.string().c_str(),
+                          std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&mNewContigsHeader),
+                  sizeof(mNewContigsHeader));
+        out.write(mNewContigs.data(), mNewContigs.size());
+
+        if (!out.good())
+        {
+          std::cerr << "Could not write contig cache " << path.string()
+                    << std::endl;
+          out.close();
+          fs::remove(tmp);
+          return;
+        }
+      }
+      replaceWithTemp(tmp.string(), path.string());
+      mNewContigs.clear();
+    }
 
-      if (!strncmp(location, "complement(", 11))
+    // Finds the TFBSs near the current contig's genes, which are sorted.
+    void
+    scanContig()
+    {
+      TraceScope trace("scanContig");
+      // Now we need to open the BaSeTraM output and start finding TFBSes...
+      if (mBuilder.mFastTFBS)
       {
-        mIsComplement = true;
-        location += 11;
+        std::string error;
+        if (mPrefetcher.take(mContigFile.string(), mContigData))
+        {
+          if (!mContigData.empty())
+            mScanner.scan(&mContigData[0],
+                          &mContigData[0] + mContigData.size(), mTFBSSink);
+        }
+        else if (!mScanner.scanFile(mContigFile.string(), mTFBSSink, error))
+          mShard->messages += "Parse error: " + error + "\n";
       }
       else
-        mIsComplement = false;
+      {
+        // The parser reads the file itself, from the page cache if it has
+        // been read ahead.
+        mPrefetcher.take(mContigFile.string(), mContigData);
+        TextSource* ts = NewBufferedFileSource(mContigFile.string().c_str());
+        mBTP->SetSource(ts);
+        try
+        {
+          mBTP->Parse();
+        }
+        catch (const ParserException& pe)
+        {
+          mShard->messages += std::string("Parse error: ") + pe.what() + "\n";
+        }
+        mBTP->SetSource(NULL);
+        delete ts;
+      }
+
+      if (mBuilder.mBatchSweep)
+        flushSites();
 
-      char* p;
-      mStart = strtoul(location, &p, 10);
-      p += 2;
-      mEnd = strtoul(p, NULL, 10);
+      mForwardGenes.clear();
+      mReverseGenes.clear();
     }
 
     void
-    CloseFeature()
+    processTFBS(bool isComplement, uint32_t start, uint32_t end,
+                uint32_t factor, double probability)
     {
-      if (!mInTFBS)
+      if (probability < mMinProbability)
         return;
 
-      mInTFBS = false;
+      // A factor with no HGNC mapping can never make an edge, so the site
+      // is counted as unused without looking for genes near it.
+      Site site(isComplement, start, probability,
+                (factor == FactorTable::kNoFactor) ?
+                0 : mBuilder.mHGNCByFactor[factor]);
+
+      if (mBuilder.mBatchSweep)
+      {
+        mSites.push_back(site);
+        return;
+      }
 
-      mTFBuilder->processTFBS(mIsComplement, mStart, mEnd, mTRANSFAC,
-                              mProbability);
+      for (uint32_t n = 0; n < mBuilder.mNetworks.size(); n++)
+      {
+        const WindowConfig& config(mBuilder.mNetworks[n].config);
+        if (probability < config.minProbability)
+          continue;
+
+        if (site.source == 0)
+          recordSite(mShard->networks[n], site, mForwardGenes,
+                     GeneWindow(0, 0));
+        else if (isComplement)
+          recordSite(mShard->networks[n], site, mReverseGenes,
+                     findGeneWindow(mReverseGenes, start, config.upstream,
+                                    config.downstream));
+        else
+          recordSite(mShard->networks[n], site, mForwardGenes,
+                     findGeneWindow(mForwardGenes, start, config.downstream,
+                                    config.upstream));
+      }
     }
-    
+
+  private:
+    // The genes of one contig, kept to be written to the gene cache.
+    class CachedContig
+    {
+    public:
+      CachedContig(const std::string& aName, const std::vector<Gene>& aForward,
+                   const std::vector<Gene>& aReverse)
+        : name(aName), forward(aForward), reverse(aReverse)
+      {
+      }
+
+      std::string name;
+      std::vector<Gene> forward, reverse;
+    };
+
+    // A TFBS over the lowest minimum probability, held until the whole
+    // contig has been read in batch mode. A source of 0 means the factor has no HGNC
+    // mapping.
+    class Site
+    {
+    public:
+      Site(bool aIsComplement, uint32_t aStart, double aProbability,
+           uint32_t aSource)
+        : isComplement(aIsComplement), start(aStart),
+          probability(aProbability), source(aSource)
+      {
+      }
+
+      bool isComplement;
+      uint32_t start;
+      double probability;
+      uint32_t source;
+    };
+
+    // Adds a TFBS and the edges to the genes in its window to the shard. The
+    // window is walked from the top down, as the original per-TFBS search
+    // did, so the edges come out in the same order either way.
     void
-    Qualifier(const char* name, const char* value)
+    recordSite(NetworkShard& aShard, const Site& aSite,
+               const std::vector<Gene>& aGenes, const GeneWindow& aWindow)
     {
-      if (!strcmp(name, "probability"))
-        mProbability = strtod(value, NULL);
-      else if (!strcmp(name, "db_xref") &&
-               !strncmp(value, "TRANSFAC:", 9))
-        mTRANSFAC = value + 9;
+      aShard.tfbsProcessed++;
+      if (aSite.source == 0)
+        aShard.unmappedSites++;
+
+      uint32_t nEdges = 0;
+      for (uint32_t i = aWindow.second; i > aWindow.first; i--)
+      {
+        aShard.edgeCalls++;
+        if (aSite.source != 0)
+        {
+          aShard.edges.push_back(std::pair<uint32_t, uint32_t>
+                                  (aGenes[i - 1].hgncId, aSite.source));
+          nEdges++;
+        }
+      }
+
+      aShard.sites.push_back(std::pair<double, uint32_t>
+                              (aSite.probability, nEdges));
     }
 
+    // Assigns all the TFBSs collected for the contig to gene windows with
+    // one sweep per strand for each network, then records them in the order
+    // they were read. The sites are only sorted once, for all of them.
     void
-    CodingData(const char* data)
+    flushSites()
     {
+      std::vector<uint64_t> forward, reverse;
+      for (uint32_t i = 0; i < mSites.size(); i++)
+        if (mSites[i].source != 0)
+          (mSites[i].isComplement ? reverse : forward).push_back
+            ((static_cast<uint64_t>(mSites[i].start) << 32) | i);
+
+      // BaSeTraM writes the sites in order, so these are usually sorted
+      // already.
+      if (std::adjacent_find(forward.begin(), forward.end(),
+                             std::greater<uint64_t>()) != forward.end())
+        std::sort(forward.begin(), forward.end());
+      if (std::adjacent_find(reverse.begin(), reverse.end(),
+                             std::greater<uint64_t>()) != reverse.end())
+        std::sort(reverse.begin(), reverse.end());
+
+      // Sites with no source are never swept, so keep their empty window.
+      std::vector<GeneWindow> windows(mSites.size(), GeneWindow(0, 0));
+      for (uint32_t n = 0; n < mBuilder.mNetworks.size(); n++)
+      {
+        const WindowConfig& config(mBuilder.mNetworks[n].config);
+        sweepGeneWindows(mForwardGenes, forward, config.downstream,
+                         config.upstream, windows);
+        sweepGeneWindows(mReverseGenes, reverse, config.upstream,
+                         config.downstream, windows);
+
+        for (uint32_t i = 0; i < mSites.size(); i++)
+          if (mSites[i].probability >= config.minProbability)
+            recordSite(mShard->networks[n], mSites[i],
+                       mSites[i].isComplement ? mReverseGenes : mForwardGenes,
+                       windows[i]);
+      }
+
+      mSites.clear();
     }
-  private:
-    TFNetBuilder* mTFBuilder;
-    std::string mTRANSFAC;
-    double mProbability;
-    bool mInTFBS, mIsComplement;
-    uint32_t mStart, mEnd;
-  };
 
-  uint32_t
-  findHGNCIdByName(const std::string& aName, bool stripDashes = true)
-  {
-    // Look up the name from HGNC...
-    std::map<std::string, uint32_t>::iterator i
-      (mHGNCIdMappings.find(aName));
-    if (i != mHGNCIdMappings.end())
-      return (*i).second;
-
-    // See if it ends in a number...
-    static const boost::regex endNumber("(\\-?)([0-9]+)$");
-    boost::smatch res;
-    if (boost::regex_search(aName, res, endNumber))
-    {
-      i = mHGNCIdMappings.find(res.prefix().str());
-      if (i != mHGNCIdMappings.end())
-        return (*i).second;
-
-      std::string tryAlso;
-      if (res[2].str() == "alpha")
-        tryAlso = "A";
-      else if (res[2].str() == "beta")
-        tryAlso = "B";
-      else if (res[2].str() == "1")
-        tryAlso = "I";
-      else if (res[2].str() == "2")
-        tryAlso = "II";
-
-      std::string attempt(res.prefix().str());
-      attempt += tryAlso;
-      i = mHGNCIdMappings.find(attempt);
-      if (i != mHGNCIdMappings.end())
-        return (*i).second;
-    }
-
-    // Try adding a suffix like 1 or A...
-    std::string attempt = aName + "1";
-    i = mHGNCIdMappings.find(attempt);
-    if (i != mHGNCIdMappings.end())
-      return (*i).second;
+    // Receives the TFBSs from either the GenBank parser or the TFBSScanner.
+    // The probability and factor carry over from one feature to the next, so
+    // a TFBS missing a qualifier takes the previous one's value.
+    class TFBSSink
+      : public GenBankSink, public TFBSScanSink
+    {
+    public:
+      TFBSSink(ChromosomeWorker* aWorker)
+        : mWorker(aWorker), mFactor(FactorTable::kNoFactor),
+          mProbability(0.0)
+      {
+      }
+
+      // What carries over into the next feature.
+      void
+      state(uint32_t& aFactor, double& aProbability) const
+      {
+        aFactor = mFactor;
+        aProbability = mProbability;
+      }
+
+      void
+      setState(uint32_t aFactor, double aProbability)
+      {
+        mFactor = aFactor;
+        mProbability = aProbability;
+      }
+
+      void
+      OpenKeyword(const char* name, const char* value)
+      {
+      }
+    
+      void
+      CloseKeyword()
+      {
+      }
+    
+      void
+      OpenFeature(const char* name, const char* location)
+      {
+        if (strcmp(name, "TFBS"))
+        {
+          mInTFBS = false;
+          return;
+        }
+
+        mInTFBS = true;
+
+        if (!strncmp(location, "complement(", 11))
+        {
+          mIsComplement = true;
+          location += 11;
+        }
+        else
+          mIsComplement = false;
+
+        char* p;
+        mStart = strtoul(location, &p, 10);
+        p += 2;
+        mEnd = strtoul(p, NULL, 10);
+      }
+
+      void
+      CloseFeature()
+      {
+        if (!mInTFBS)
+          return;
+
+        mInTFBS = false;
+
+        mWorker->processTFBS(mIsComplement, mStart, mEnd, mFactor,
+                             mProbability);
+      }
     
-    attempt = aName + "A";
-    i = mHGNCIdMappings.find(attempt);
-    if (i != mHGNCIdMappings.end())
-      return (*i).second;
+      void
+      Qualifier(const char* name, const char* value)
+      {
+        if (!strcmp(name, "probability"))
+          mProbability = strtod(value, NULL);
+        else if (!strcmp(name, "db_xref") &&
+                 !strncmp(value, "TRANSFAC:", 9))
+          mFactor = mWorker->mBuilder.mFactors.find(value + 9,
+                                                    strlen(value + 9));
+      }
+
+      void
+      CodingData(const char* data)
+      {
+      }
+
+      void
+      Probability(double aProbability)
+      {
+        mProbability = aProbability;
+      }
+
+      void
+      Factor(const char* aAccession, size_t aLength)
+      {
+        mFactor = mWorker->mBuilder.mFactors.find(aAccession, aLength);
+      }
 
-    if (stripDashes)
+      void
+      TFBS(bool aIsComplement, uint32_t aStart, uint32_t aEnd)
+      {
+        mWorker->processTFBS(aIsComplement, aStart, aEnd, mFactor,
+                             mProbability);
+      }
+    private:
+      ChromosomeWorker* mWorker;
+      uint32_t mFactor;
+      double mProbability;
+      bool mInTFBS, mIsComplement;
+      uint32_t mStart, mEnd;
+    };
+
+    const TFNetBuilder& mBuilder;
+    GenBankParser* mGBP, * mBTP;
+    fs::path mChromosomeDir, mContigFile;
+    bool mComplement;
+    uint32_t mGeneStart, mGeneEnd;
+    std::vector<Gene> mForwardGenes, mReverseGenes;
+    bool mRecordContigs;
+    std::vector<CachedContig> mCachedContigs;
+    bool mCachingContigs;
+    io::mapped_file_source mOldContigs;
+    std::map<std::string, std::pair<const char*, size_t> > mOldContigIndex;
+    uint32_t mOldContigCount;
+    ContigCache::Header mNewContigsHeader;
+    std::string mNewContigs;
+    bool mContigsChanged;
+    std::vector<Site> mSites;
+    double mMinProbability;
+    ChromosomeShard* mShard;
+    uint64_t mContigsDone;
+    TFBSSink mTFBSSink;
+    TFBSScanner mScanner;
+    GeneExtractor mGeneExtractor;
+    std::vector<char> mContigData;
+    ContigPrefetcher mPrefetcher;
+  };
+
+  void
+  runWorker(ChromosomeQueue& aQueue)
+  {
+    if (Tracer::active())
+      Tracer::active()->nameThread("worker");
+    ChromosomeWorker worker(*this);
+
+    while (true)
     {
-      // Strip out all dashes and repeat...
-      std::string dashless(boost::replace_all_copy(aName, "ALPHA", "A"));
-      boost::replace_all(dashless, "-", "");
-      return findHGNCIdByName(dashless, false);
+      size_t i;
+      {
+        boost::mutex::scoped_lock lock(aQueue.mutex);
+        if (aQueue.next == aQueue.files.size())
+          return;
+        i = aQueue.next++;
+      }
+
+      ChromosomeShard* shard = new ChromosomeShard(mNetworks.size());
+      worker.processChromosome(aQueue.files[i], *shard);
+
+      boost::mutex::scoped_lock lock(aQueue.mutex);
+      aQueue.shards[i] = shard;
+      aQueue.shardDone.notify_all();
     }
+  }
+
+  void
+  mergeShard(const ChromosomeShard& aShard, std::ostream& aMessages)
+  {
+    TraceScope trace("mergeShard");
+    aMessages << aShard.messages;
+
+    for (uint32_t n = 0; n < mNetworks.size(); n++)
+      mergeNetworkShard(aShard.networks[n], mNetworks[n]);
 
-    return 0;
+    if (mMetrics)
+      mMetrics->merged(mNetworks[0].tfbsUsed, mNetworks[0].tfbsUnused);
   }
 
-  TFBSSink mTFBSSink;
+  static void
+  mergeNetworkShard(const NetworkShard& aShard, Network& aNetwork)
+  {
+    aNetwork.tfbsProcessed += aShard.tfbsProcessed;
+    aNetwork.edgeCalls += aShard.edgeCalls;
+    aNetwork.tfbsUnmapped += aShard.unmappedSites;
+
+    std::vector<std::pair<uint32_t, uint32_t> >::const_iterator
+      edge(aShard.edges.begin());
+    for
+    (
+     std::vector<std::pair<double, uint32_t> >::const_iterator i =
+       aShard.sites.begin();
+     i != aShard.sites.end();
+     i++
+    )
+    {
+      bool hadEdge = false;
+      for (uint32_t n = 0; n < (*i).second; n++, edge++)
+        hadEdge |= aNetwork.processEdge((*edge).first, (*edge).second);
+
+      if (hadEdge)
+      {
+        aNetwork.tfbsUsed++;
+        aNetwork.tfbsUsedProbs += (*i).first;
+      }
+      else
+      {
+        aNetwork.tfbsUnused++;
+        aNetwork.tfbsUnusedProbs += (*i).first;
+      }
+    }
+  }
 };
 
+// Writes out the trace, if one is being taken, and passes aStatus on (or
+// 1, if the trace cannot be written).
+static int
+finishTrace(const std::string& aPath, int aStatus)
+{
+  if (Tracer::active() == NULL)
+    return aStatus;
+
+  std::string error;
+  if (!Tracer::active()->write(aPath, error))
+  {
+    std::cerr << error << std::endl;
+    return 1;
+  }
+  return aStatus;
+}
+
 int
 main(int argc, char** argv)
 {
-  std::string basetram, genbank, hgnc, matrices;
+  std::string basetram, genbank, hgnc, matrices, indexCache, geneCache,
+    contigCache, format, outDir, trace, metrics;
+  std::vector<std::string> windows;
+  uint32_t threads, prefetch;
+  double metricsInterval;
 
   po::options_description desc;
 
@@ -630,6 +2443,48 @@ main(int argc, char** argv)
     ("hgnc", po::value<std::string>(&hgnc), "File containing the HGNC names database")
     ("matrices", po::value<std::string>(&matrices), "File containing the TRANSFAC matrices "
      "database")
+    ("index-cache", po::value<std::string>(&indexCache), "Compiled snapshot of "
+     "the HGNC and TRANSFAC indices; rebuilt whenever either source changes")
+    ("gene-cache", po::value<std::string>(&geneCache), "Directory to keep "
+     "the genes read from each chromosome in, so unchanged chromosomes are "
+     "not parsed again")
+    ("contig-cache", po::value<std::string>(&contigCache), "Directory to "
+     "keep what each contig contributed in, so a rebuild only processes the "
+     "contigs whose genes, BaSeTraM output or parameters changed")
+    ("threads", po::value<uint32_t>(&threads)->default_value(1), "Number of "
+     "chromosomes to process in parallel, and of chunks to parse the HGNC "
+     "database in")
+    ("per-tfbs-search", "Find the gene window for each TFBS with a separate "
+     "binary search, instead of one sweep per contig")
+    ("fast-tfbs", "Read the BaSeTraM output with the dedicated TFBS scanner "
+     "instead of the general GenBank parser")
+    ("fast-genes", "Read the chromosome files with the dedicated gene "
+     "extractor, which skips the sequence data")
+    ("prefetch", po::value<uint32_t>(&prefetch)->default_value(0), "MB of "
+     "memory, shared between the threads, to read upcoming contigs' BaSeTraM "
+     "output ahead into while the current one is processed; 0 reads each "
+     "when it is reached")
+    ("format", po::value<std::string>(&format)->default_value("text"),
+     "Output format: text, or binary (progress messages then go to stderr)")
+    ("window", po::value<std::vector<std::string> >(&windows)->composing(),
+     "Window configuration upstream,downstream[,minProbability[,minRegs]] "
+     "to build a network for; may be given more than once to build several "
+     "networks in one pass (default 15000,1000,0.5,1)")
+    ("out-dir", po::value<std::string>(&outDir), "Directory to write each "
+     "network to, named after its window configuration, instead of standard "
+     "output; needed with more than one --window")
+    ("trace", po::value<std::string>(&trace), "File to write a Chrome trace "
+     "of the run's stages to (loading the indices, each chromosome and "
+     "contig, writing the output), with a track for each thread")
+    ("progress", "Report progress and throughput to stderr while the "
+     "chromosomes are processed")
+    ("metrics", po::value<std::string>(&metrics), "Prometheus text format "
+     "file to keep the progress metrics in, rewritten at each report "
+     "(implies --progress)")
+    ("metrics-interval", po::value<double>(&metricsInterval)->default_value(10),
+     "Seconds between progress reports")
+    ("verify-resolver", "Check the compiled HGNC name resolver against "
+     "the reference rules over the whole HGNC set, then exit")
     ("help", "produce help message")
     ;
   
@@ -639,11 +2494,12 @@ main(int argc, char** argv)
   po::notify(vm);
 
   std::string wrong;
+  bool verifyResolver = vm.count("verify-resolver") != 0;
   if (!vm.count("help"))
   {
-    if (!vm.count("basetram"))
+    if (!vm.count("basetram") && !verifyResolver)
       wrong = "basetram";
-    else if (!vm.count("genbank"))
+    else if (!vm.count("genbank") && !verifyResolver)
       wrong = "genbank";
     else if (!vm.count("hgnc"))
       wrong = "hgnc";
@@ -659,6 +2515,53 @@ main(int argc, char** argv)
     return 1;
   }
 
+  if (format != "text" && format != "binary")
+  {
+    std::cerr << "Output format must be text or binary." << std::endl;
+    return 1;
+  }
+  bool binary = (format == "binary");
+
+  std::vector<WindowConfig> configs;
+  for (uint32_t i = 0; i < windows.size(); i++)
+  {
+    WindowConfig config;
+    if (!config.parse(windows[i]))
+    {
+      std::cerr << "Invalid window configuration: " << windows[i] << std::endl;
+      return 1;
+    }
+    configs.push_back(config);
+  }
+  for (uint32_t i = 0; i < configs.size(); i++)
+    for (uint32_t j = 0; j < i; j++)
+      if (configs[j].name() == configs[i].name())
+      {
+        std::cerr << "Window configuration given more than once: "
+                  << configs[i].name() << std::endl;
+        return 1;
+      }
+  if (configs.size() > 1 && outDir == "")
+  {
+    std::cerr << "More than one --window needs --out-dir." << std::endl;
+    return 1;
+  }
+  if (!(metricsInterval > 0))
+  {
+    std::cerr << "--metrics-interval must be more than 0." << std::endl;
+    return 1;
+  }
+
+  if (verifyResolver)
+  {
+    TFNetBuilder tfnb(basetram);
+    if (indexCache == "" ||
+        !tfnb.loadIndexSnapshot(indexCache, hgnc, matrices))
+      if (!tfnb.loadHGNCDatabase(hgnc, threads))
+        return 1;
+    return tfnb.verifyResolver(std::cout) == 0 ? 0 : 1;
+  }
+
   if (!fs::is_directory(basetram))
   {
     std::cerr << "Supplied BaSeTraM 'directory' is not a valid directory."
@@ -673,26 +2576,78 @@ main(int argc, char** argv)
     return 1;
   }
 
+  Tracer tracer;
+  if (trace != "")
+  {
+    Tracer::active() = &tracer;
+    tracer.nameThread("main");
+  }
+
+  BuildMetrics buildMetrics;
   TFNetBuilder tfnb(basetram);
+  if (vm.count("progress") || metrics != "")
+  {
+    buildMetrics.start(metricsInterval, metrics);
+    tfnb.setMetrics(&buildMetrics);
+  }
+  if (!configs.empty())
+    tfnb.setWindowConfigs(configs);
+  tfnb.setBatchSweep(!vm.count("per-tfbs-search"));
+  tfnb.setFastTFBS(vm.count("fast-tfbs") != 0);
+  tfnb.setFastGenes(vm.count("fast-genes") != 0);
+  tfnb.setPrefetchBudget(static_cast<uint64_t>(prefetch) << 20);
+  if (geneCache != "")
+  {
+    fs::create_directories(geneCache);
+    tfnb.setGeneCache(geneCache);
+  }
+  if (contigCache != "")
+  {
+    fs::create_directories(contigCache);
+    tfnb.setContigCache(contigCache);
+  }
+
+  if (indexCache == "" || !tfnb.loadIndexSnapshot(indexCache, hgnc, matrices))
+  {
+    if (!tfnb.loadHGNCDatabase(hgnc, threads) ||
+        !tfnb.indexMatrices(matrices))
+      return finishTrace(trace, 1);
+    if (indexCache != "")
+      tfnb.saveIndexSnapshot(indexCache, hgnc, matrices);
+  }
 
   // Now we start iterating through the GenBank files...
+  std::vector<std::string> chromosomes;
   for (fs::directory_iterator it(genbank); it != fs::directory_iterator(); it++)
   {
     if (fs::extension(it->path()) != ".gbk")
       continue;
 
-    tfnb.loadHGNCDatabase(hgnc);
-    tfnb.indexMatrices(matrices);
-    try
-    {
-      tfnb.processChromosome(it->path().string());
-    }
-    catch (const ParserException& pe)
+    chromosomes.push_back(it->path().string());
+  }
+
+  tfnb.processChromosomes(chromosomes, threads,
+                          (binary && outDir == "") ? std::cerr : std::cout);
+
+  if (outDir == "")
+  {
+    tfnb.generateOutput(std::cout, binary);
+    return finishTrace(trace, 0);
+  }
+
+  fs::create_directories(outDir);
+  for (uint32_t n = 0; n < tfnb.networkCount(); n++)
+  {
+    fs::path path(outDir);
+    path /= tfnb.windowConfig(n).name() + (binary ? ".bin" : ".txt");
+    std::ofstream out(path.string().c_str(), std::ios::binary);
+    tfnb.generateOutput(out, binary, n);
+    if (!out.good())
     {
-      std::cout << "Parser error: " << pe.what() << std::endl;
+      std::cerr << "Could not write " << path.string() << std::endl;
+      return finishTrace(trace, 1);
     }
-    tfnb.dealWithContig();
   }
 
-  tfnb.generateOutput(std::cout);
+  return finishTrace(trace, 0);
 }
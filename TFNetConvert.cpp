@@ -0,0 +1,69 @@
+#include <boost/program_options.hpp>
+#include <iostream>
+#include <fstream>
+#include "NetworkModel.hpp"
+
+namespace po = boost::program_options;
+
+int
+main(int argc, char** argv)
+{
+  std::string input, output, format;
+
+  po::options_description desc;
+
+  desc.add_options()
+    ("input", po::value<std::string>(&input), "TF net model to convert (text or binary)")
+    ("output", po::value<std::string>(&output), "File to write the converted model to")
+    ("format", po::value<std::string>(&format)->default_value("binary"),
+     "Format to write: text or binary")
+    ("help", "produce help message")
+    ;
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  std::string wrong;
+  if (!vm.count("help"))
+  {
+    if (!vm.count("input"))
+      wrong = "input";
+    else if (!vm.count("output"))
+      wrong = "output";
+  }
+
+  if (wrong != "")
+    std::cerr << "Missing option: " << wrong << std::endl;
+
+  if (vm.count("help") || wrong != "")
+  {
+    std::cerr << desc << std::endl;
+    return 1;
+  }
+
+  if (format != "text" && format != "binary")
+  {
+    std::cerr << "Output format must be text or binary." << std::endl;
+    return 1;
+  }
+
+  NetworkModel model;
+  if (!model.load(input, std::cerr))
+    return 1;
+
+  std::ofstream out(output.c_str(), std::ios::binary);
+  if (format == "binary")
+    model.writeBinary(out);
+  else
+    model.writeText(out);
+
+  if (!out.good())
+  {
+    std::cerr << "Could not write " << output << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
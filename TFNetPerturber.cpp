@@ -1,559 +1,275 @@
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
-#include <boost/regex.hpp>
 #include <iostream>
-#include <fstream>
+#include <sstream>
 #include <boost/random.hpp>
-#include <boost/lambda/lambda.hpp>
-#include <boost/lambda/bind.hpp>
+#include <boost/algorithm/string/split.hpp>
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind/bind.hpp>
+#include <fstream>
+#include <unistd.h>
 #include <map>
+#include "NetworkModel.hpp"
+#include "EnsembleStatistics.hpp"
+#include "ModelPerturbers.hpp"
 
 namespace po = boost::program_options;
-namespace bll = boost::lambda;
+namespace fs = boost::filesystem;
 
-class ModelPerturber;
-
-class ModelPerturber
+// One step of SplitMix64 from aX: advances it and scrambles the result.
+static uint64_t
+splitMix(uint64_t aX)
 {
-public:
-  ModelPerturber(const char* aName)
-    : mName(aName)
-  {
-    sRegistry.insert(std::pair<std::string, ModelPerturber*>(aName, this));
-  }
-
-  static ModelPerturber* findPerturberByName(const std::string& aName)
-  {
-    RegistryType::iterator i = sRegistry.find(aName);
-    if (i == sRegistry.end())
-      return NULL;
-    
-    return (*i).second;
-  }
-
-  static void listAvailablePerturbers(std::ostream& aOut)
-  {
-    aOut << "Available perturbers:" << std::endl;
-    for (RegistryType::iterator i = sRegistry.begin();
-         i != sRegistry.end();
-         i++)
-      aOut << "\t* " << (*i).first << std::endl
-           << "\t\t* Parameter choices: " << (*i).second->getParameterHelp()
-           << std::endl;
-  }
-
-  virtual const char* getParameterHelp() = 0;
-  virtual void perturb(const std::string& aModelFile) = 0;
-  const char* name()
-  {
-    return mName;
-  }
+  uint64_t z = aX + 0x9E3779B97F4A7C15ULL;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
 
-  virtual void setParams(const std::string& aParams)
+// Seeds aRng for one step of one replicate. The whole Mersenne Twister state
+// is filled from a SplitMix64 stream keyed on the run's seed, the replicate
+// and the step, so every replicate gets an independent stream that does not
+// depend on the threads or on which parameters it is generated with. The
+// key chains each input through the mixer in turn, rather than packing them
+// into one word, so no two (seed, replicate, step) share a stream by
+// accident of their bits.
+static void
+seedStep(boost::mt19937& aRng, uint64_t aSeed, uint32_t aReplicate,
+         uint32_t aStep)
+{
+  static const uint32_t kStateWords = 624;
+  uint64_t x = splitMix(splitMix(splitMix(aSeed) ^ aReplicate) ^ aStep);
+  std::vector<uint32_t> state(kStateWords);
+  for (uint32_t i = 0; i < kStateWords; i++)
   {
+    x += 0x9E3779B97F4A7C15ULL;
+    uint64_t z = x;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    state[i] = static_cast<uint32_t>((z ^ (z >> 31)) >> 32);
   }
+  std::vector<uint32_t>::iterator first = state.begin();
+  aRng.seed(first, state.end());
+}
 
-private:
-  const char* mName;
-  typedef std::map<std::string, ModelPerturber*> RegistryType;
-  static RegistryType sRegistry;
-};
-
-ModelPerturber::RegistryType ModelPerturber::sRegistry;
-
-class LabelSwitchingPerturber
-  : public ModelPerturber
+// Generates every replicate for every combination of step parameters,
+// sharing out the work between threads. Each thread has its own copies of
+// the perturbers and a pair of models to chain the steps through, and
+// writes each replicate as soon as it is made, or in an ensemble, measures
+// it and adds it to the statistics for its parameters.
+class ReplicateGenerator
 {
 public:
-  LabelSwitchingPerturber()
-    : ModelPerturber("label_switching"), mProb(1.0)
+  ReplicateGenerator(const NetworkModel& aModel,
+                     const std::vector<ModelPerturber*>& aSteps,
+                     const std::vector<std::vector<std::string> >& aCombinations,
+                     uint32_t aReplicates, uint64_t aSeed,
+                     const std::string& aOutDir)
+    : mModel(aModel), mSteps(aSteps), mCombinations(aCombinations),
+      mReplicates(aReplicates), mSeed(aSeed), mOutDir(aOutDir),
+      mReference(NULL), mStatistics(NULL), mNext(0), mFailed(false)
   {
   }
 
+  // Summarises the replicates in aStatistics, one for each combination of
+  // parameters, instead of writing them out.
   void
-  setParams(const std::string& aParams)
+  summarise(const EnsembleReference& aReference,
+            std::vector<EnsembleStatistics>& aStatistics)
   {
-    mProb = strtod(aParams.c_str(), NULL);
+    mReference = &aReference;
+    mStatistics = &aStatistics;
   }
 
-  void
-  perturb(const std::string& aModelFile)
+  bool
+  run(uint32_t aThreads)
   {
-    std::ifstream modelFile(aModelFile.c_str());
-
-    std::string l;
-    std::getline(modelFile, l);
-    if (l != "VERTICES")
+    uint64_t jobs = static_cast<uint64_t>(mCombinations.size()) * mReplicates;
+    if (aThreads > jobs)
+      aThreads = jobs;
+    if (aThreads <= 1)
+      work();
+    else
     {
-      std::cerr << "Expected VERTICES line" << std::endl;
-      return;
+      boost::thread_group workers;
+      for (uint32_t i = 0; i < aThreads; i++)
+        workers.create_thread(boost::bind(&ReplicateGenerator::work, this));
+      workers.join_all();
     }
-    std::cout << l << std::endl;
-    
-    static const boost::regex vertexr("^VERTEX ([0-9]+) (.*)$");
-    
-    std::list<std::string> allNames;
-    std::vector<std::pair<uint32_t, uint32_t> > allNumbers;
-    boost::mt19937 rng;
-    
-    rng.seed(time(0));
-    
-    while (modelFile.good())
-    {
-      std::getline(modelFile, l);
-      if (l == "ENDVERTICES")
-        break;
-      
-      boost::smatch m;
-      if (boost::regex_match(l, m, vertexr))
-      {
-        boost::uniform_real<double> ur;
-        // Include it in the shuffle pool with probability mProb.
-        if (ur(rng) < mProb)
-        {
-          uint32_t n(strtoul(m[1].str().c_str(), NULL, 10));
-          allNames.push_back(m[2]);
-          uint32_t rv(rng());
-          allNumbers.push_back(std::pair<uint32_t, uint32_t>(n, rv));
-        }
-        else
-        {
-          std::cout << "VERTEX " << m[1].str() << " "
-                    << m[2].str() << std::endl;
-        }
-      }
-    }
-
-    // Now scramble allNumbers...
-    std::sort(
-              allNumbers.begin(), allNumbers.end(),
-              bll::bind<uint32_t>(&std::pair<uint32_t, uint32_t>::second, bll::_1) <
-              bll::bind<uint32_t>(&std::pair<uint32_t, uint32_t>::second, bll::_2)
-             );
-
-    // Write out the vertices with their new names...
-    std::list<std::string>::iterator i;
-    std::vector<std::pair<uint32_t, uint32_t> >::iterator j;
-    for (i = allNames.begin(), j = allNumbers.begin(); i != allNames.end();
-         i++, j++)
-    {
-      std::cout << "VERTEX " << (*j).first << " " << (*i) << std::endl;
-    }
-    std::cout << "ENDVERTICES" << std::endl;
-
-    while (modelFile.good())
-    {
-      std::getline(modelFile, l);
-      std::cout << l << std::endl;
-    }
-  }
-
-  const char* getParameterHelp()
-  {
-    return "Use --params=<probability> to specify the probability a genes / label is "
-      "included in the pool to be scrambled.";
-  }
-  
-private:
-  double mProb;
-};
-static LabelSwitchingPerturber klsp;
-
-class EdgeDeletingPerturber
-  : public ModelPerturber
-{
-public:
-  EdgeDeletingPerturber()
-    : ModelPerturber("edge_deleting"), mProbDeletion(0.5)
-  {
-  }
-
-  void
-  setParams(const std::string& aParams)
-  {
-    mProbDeletion = strtod(aParams.c_str(), NULL);
+    return !mFailed;
   }
 
-  const char* getParameterHelp()
+  // Makes one replicate with one combination of parameters, or returns
+  // NULL, with aError set, if a step cannot be done.
+  const NetworkModel*
+  generate(const std::vector<ModelPerturber*>& aSteps,
+           const std::vector<std::string>& aParams, uint32_t aReplicate,
+           NetworkModel (&aNetworks)[2], std::string& aError)
   {
-    return "Use --params=<probDeletion> to set the probability a given edge is deleted.";
-  }
-
-  void
-  perturb(const std::string& aModelFile)
-  {
-    std::ifstream modelFile(aModelFile.c_str());
-
-    std::string l;
-    std::getline(modelFile, l);
-    if (l != "VERTICES")
-    {
-      std::cerr << "Expected VERTICES line" << std::endl;
-      return;
-    }
-    std::cout << l << std::endl;
-
-    while (modelFile.good())
-    {
-      std::getline(modelFile, l);
-      
-      std::cout << l << std::endl;
-      if (l == "ENDVERTICES")
-        break;
-    }
-
-    static const boost::regex edger("^EDGES ([0-9]+) \\(([^\\)]+)\\)$");
-    boost::smatch m;
+    const NetworkModel* current = &mModel;
     boost::mt19937 rng;
-    boost::uniform_real<double> ur;
-
-    rng.seed(time(0));
-
-    while (modelFile.good())
+    for (uint32_t i = 0; i < aSteps.size(); i++)
     {
-      std::getline(modelFile, l);
-
-      if (!modelFile.good())
-        break;
-
-      if (boost::regex_match(l, m, edger))
-      {
-        std::string regs;
-        boost::sregex_token_iterator e;
-        const boost::regex split("[ \t]+");
-        std::string match(m[2]);
-        for (boost::sregex_token_iterator i = boost::make_regex_token_iterator(match, split, -1);
-             i != e; i++)
-        {
-          if (*i == "")
-            continue;
-          if (ur(rng) <= mProbDeletion)
-            continue;
-          regs += *i + " ";
-        }
-
-        if (regs == "")
-          continue;
-
-        std::cout << "EDGES " << m[1] << " (" << regs << ")"
-                  << std::endl;
-      }
-      else
-        std::cout << l << std::endl;
+      aSteps[i]->resetParams();
+      if (aParams[i] != "")
+        aSteps[i]->setParams(aParams[i]);
+      seedStep(rng, mSeed, aReplicate, i);
+
+      NetworkModel& result(aNetworks[i % 2]);
+      result.clear();
+      if (!aSteps[i]->perturb(*current, result, rng, aError))
+        return NULL;
+      current = &result;
     }
+    return current;
   }
 
-private:
-  double mProbDeletion;
-};
-static EdgeDeletingPerturber kedp;
-
-class EdgeInsertingPerturber
-  : public ModelPerturber
-{
-public:
-  EdgeInsertingPerturber()
-    : ModelPerturber("edge_inserting"), mPercentInserted(0.5)
+  // The steps with their parameters, as in "edge_deleting-0.1_label_switching"
+  // (parameters left at their defaults are not shown).
+  std::string
+  label(const std::vector<std::string>& aParams) const
   {
+    std::ostringstream name;
+    for (uint32_t i = 0; i < mSteps.size(); i++)
+    {
+      if (i != 0)
+        name << "_";
+      name << mSteps[i]->name();
+      if (aParams[i] != "")
+        name << "-" << aParams[i];
+    }
+    return name.str();
   }
 
-  void
-  setParams(const std::string& aParams)
-  {
-    mPercentInserted = strtod(aParams.c_str(), NULL);
-  }
-
-  const char* getParameterHelp()
+  // The file a replicate goes in, named after its parameters.
+  std::string
+  fileName(const std::vector<std::string>& aParams, uint32_t aReplicate) const
   {
-    return "Use --params=<percentInsertion> to set the number of edges to insert as a "
-      "percentage of the current edge count.";
+    std::ostringstream name;
+    name << label(aParams) << "_r" << aReplicate << ".txt";
+    return (boost::filesystem::path(mOutDir) / name.str()).string();
   }
 
+private:
   void
-  perturb(const std::string& aModelFile)
+  work()
   {
-    std::ifstream modelFile(aModelFile.c_str());
-
-    std::string l;
-    std::getline(modelFile, l);
-
-    if (l != "VERTICES")
-    {
-      std::cerr << "Expected VERTICES line" << std::endl;
-      return;
-    }
-    std::cout << l << std::endl;
-
-    static const boost::regex vertexr("^VERTEX ([0-9]+) .*$");
-    boost::smatch m;
-
-    std::vector<uint32_t> vertices;
-
-    while (modelFile.good())
+    std::vector<ModelPerturber*> steps;
+    for (uint32_t i = 0; i < mSteps.size(); i++)
+      steps.push_back(mSteps[i]->clone());
+    NetworkModel networks[2];
+    NetworkMeasures measures;
+    std::string error;
+
+    while (true)
     {
-      std::getline(modelFile, l);
-      
-      std::cout << l << std::endl;
-      if (l == "ENDVERTICES")
-        break;
-
-      if (boost::regex_match(l, m, vertexr))
+      uint64_t job;
       {
-        vertices.push_back(strtoul(m[1].str().c_str(), NULL, 10));
+        boost::mutex::scoped_lock lock(mMutex);
+        job = mNext++;
       }
-    }
-
-    static const boost::regex edger("^EDGES ([0-9]+) \\(([^\\)]+)\\)$");
-    boost::mt19937 rng;
-
-    rng.seed(time(0));
-
-    std::set<std::pair<uint32_t, uint32_t> > edges;
-
-    while (modelFile.good())
-    {
-      std::getline(modelFile, l);
-
-      if (!modelFile.good())
+      if (job >= static_cast<uint64_t>(mCombinations.size()) * mReplicates)
         break;
 
-      if (boost::regex_match(l, m, edger))
+      const std::vector<std::string>& params(mCombinations[job / mReplicates]);
+      uint32_t replicate = job % mReplicates;
+      const NetworkModel* network =
+        generate(steps, params, replicate, networks, error);
+      if (network == NULL)
       {
-        uint32_t regulated = strtoul(m[1].str().c_str(), NULL, 10);
-
-        std::string regs;
-        boost::sregex_token_iterator e;
-        const boost::regex split("[ \t]+");
-        std::string match(m[2]);
-        for (boost::sregex_token_iterator i = boost::make_regex_token_iterator(match, split, -1);
-             i != e; i++)
-        {
-          uint32_t regulator = strtoul((*i).str().c_str(), NULL, 10);
-          edges.insert(std::pair<uint32_t, uint32_t>(regulated, regulator));
-        }
+        boost::mutex::scoped_lock lock(mMutex);
+        std::cerr << label(params) << " replicate " << replicate << ": "
+                  << error << std::endl;
+        mFailed = true;
+        continue;
       }
-    }
 
-    boost::uniform_int<uint32_t> ur(0, vertices.size() - 1);
-    uint32_t numAdditions = edges.size() * mPercentInserted * 0.01;
-    for (uint32_t i = 0; i < numAdditions; i++)
-    {
-      uint32_t regulator, regulated;
-      while (true)
+      if (mStatistics != NULL)
       {
-        regulator = vertices[ur(rng)];
-        regulated = vertices[ur(rng)];
-        if (regulator == regulated)
-          continue;
-
-        std::pair<uint32_t, uint32_t> p(regulated, regulator);
-        if (edges.count(p) == 0)
-        {
-          edges.insert(p);
-          break;
-        }
+        mReference->measure(*network, measures);
+        boost::mutex::scoped_lock lock(mMutex);
+        (*mStatistics)[job / mReplicates].add(measures);
+        continue;
       }
-    }
 
-    std::map<uint32_t, std::vector<uint32_t> > collatedEdges;
-    for (std::set<std::pair<uint32_t, uint32_t> >::iterator i = edges.begin();
-         i != edges.end();
-         i++)
-    {
-      if (collatedEdges.count((*i).first) == 0)
+      std::string path(fileName(params, replicate));
+      std::ofstream out(path.c_str(), std::ios::binary);
+      network->writeText(out);
+      if (!out.good())
       {
-        std::vector<uint32_t> v;
-        v.push_back((*i).second);
-        collatedEdges.insert(std::pair<uint32_t, std::vector<uint32_t> >((*i).first, v));
+        boost::mutex::scoped_lock lock(mMutex);
+        std::cerr << "Could not write " << path << std::endl;
+        mFailed = true;
       }
-      else
-        collatedEdges[(*i).first].push_back((*i).second);
     }
 
-   
-    for (std::map<uint32_t, std::vector<uint32_t> >::iterator i = collatedEdges.begin();
-         i != collatedEdges.end();
-         i++)
-    {
-      std::cout << "EDGES " << (*i).first << " (";
-      for (std::vector<uint32_t>::iterator j = (*i).second.begin();
-           j != (*i).second.end();
-           j++)
-        std::cout << (*j) << " ";
-      std::cout << ")" << std::endl;
-    }
+    for (uint32_t i = 0; i < steps.size(); i++)
+      delete steps[i];
   }
 
-private:
-  double mPercentInserted;
+  const NetworkModel& mModel;
+  const std::vector<ModelPerturber*>& mSteps;
+  const std::vector<std::vector<std::string> >& mCombinations;
+  uint32_t mReplicates;
+  uint64_t mSeed;
+  std::string mOutDir;
+  const EnsembleReference* mReference;
+  std::vector<EnsembleStatistics>* mStatistics;
+
+  boost::mutex mMutex;
+  uint64_t mNext;
+  bool mFailed;
 };
-static EdgeInsertingPerturber keip;
 
-class EdgeReplacingPerturber
-  : public ModelPerturber
+// Splits each of the arguments given for a list option at aSeparator.
+static void
+splitList(const std::vector<std::string>& aArgs, const char* aSeparator,
+          std::vector<std::string>& aItems)
 {
-public:
-  EdgeReplacingPerturber()
-    : ModelPerturber("edge_replacing"), mProbReplaced(0.5)
-  {
-  }
-
-  void
-  setParams(const std::string& aParams)
+  for (uint32_t i = 0; i < aArgs.size(); i++)
   {
-    mProbReplaced = strtod(aParams.c_str(), NULL);
-  }
-
-  const char* getParameterHelp()
-  {
-    return "Use --params=<probReplaced> to set the probability a given edge "
-      "gets replaced in the model.";
-  }
-
-  void
-  perturb(const std::string& aModelFile)
-  {
-    std::ifstream modelFile(aModelFile.c_str());
-
-    std::string l;
-    std::getline(modelFile, l);
-
-    if (l != "VERTICES")
-    {
-      std::cerr << "Expected VERTICES line" << std::endl;
-      return;
-    }
-    std::cout << l << std::endl;
-
-    static const boost::regex vertexr("^VERTEX ([0-9]+) .*$");
-    boost::smatch m;
-
-    std::vector<uint32_t> vertices;
-
-    while (modelFile.good())
-    {
-      std::getline(modelFile, l);
-      
-      std::cout << l << std::endl;
-      if (l == "ENDVERTICES")
-        break;
-
-      if (boost::regex_match(l, m, vertexr))
-      {
-        vertices.push_back(strtoul(m[1].str().c_str(), NULL, 10));
-      }
-    }
-
-    static const boost::regex edger("^EDGES ([0-9]+) \\(([^\\)]+)\\)$");
-    boost::mt19937 rng;
-
-    rng.seed(time(0));
-
-    std::set<std::pair<uint32_t, uint32_t> > edges;
-
-    while (modelFile.good())
-    {
-      std::getline(modelFile, l);
-
-      if (!modelFile.good())
-        break;
-
-      if (boost::regex_match(l, m, edger))
-      {
-        uint32_t regulated = strtoul(m[1].str().c_str(), NULL, 10);
-
-        std::string regs;
-        boost::sregex_token_iterator e;
-        const boost::regex split("[ \t]+");
-        std::string match(m[2]);
-        for (boost::sregex_token_iterator i = boost::make_regex_token_iterator(match, split, -1);
-             i != e; i++)
-        {
-          uint32_t regulator = strtoul((*i).str().c_str(), NULL, 10);
-          edges.insert(std::pair<uint32_t, uint32_t>(regulated, regulator));
-        }
-      }
-    }
-
-    std::set<std::pair<uint32_t, uint32_t> > newEdges(edges);
-    boost::uniform_real<double> ur;
-    boost::uniform_int<uint32_t> iur(0, vertices.size() - 1);
-
-    for (
-         std::set<std::pair<uint32_t, uint32_t> >::iterator i =
-           edges.begin();
-         i != edges.end();
-         i++
-        )
-    {
-      if (ur(rng) < mProbReplaced)
-      {
-        while (true)
-        {
-          uint32_t regulator = vertices[iur(rng)];
-          uint32_t regulated = vertices[iur(rng)];
-          if (regulator == regulated)
-            continue;
-
-          std::pair<uint32_t, uint32_t> p(regulated, regulator);
-          if (edges.count(p) == 0 && newEdges.count(p) == 0)
-          {
-            newEdges.insert(p);
-            break;
-          }
-        }
-      }
-      else
-      {
-        newEdges.insert(*i);
-      }
-    }
-
-    std::map<uint32_t, std::vector<uint32_t> > collatedEdges;
-    for (std::set<std::pair<uint32_t, uint32_t> >::iterator i = newEdges.begin();
-         i != newEdges.end();
-         i++)
-    {
-      if (collatedEdges.count((*i).first) == 0)
-      {
-        std::vector<uint32_t> v;
-        v.push_back((*i).second);
-        collatedEdges.insert(std::pair<uint32_t, std::vector<uint32_t> >((*i).first, v));
-      }
-      else
-        collatedEdges[(*i).first].push_back((*i).second);
-    }
-
-   
-    for (std::map<uint32_t, std::vector<uint32_t> >::iterator i = collatedEdges.begin();
-         i != collatedEdges.end();
-         i++)
-    {
-      std::cout << "EDGES " << (*i).first << " (";
-      for (std::vector<uint32_t>::iterator j = (*i).second.begin();
-           j != (*i).second.end();
-           j++)
-        std::cout << (*j) << " ";
-      std::cout << ")" << std::endl;
-    }
+    std::vector<std::string> items;
+    boost::split(items, aArgs[i], boost::is_any_of(aSeparator));
+    aItems.insert(aItems.end(), items.begin(), items.end());
   }
-
-private:
-  double mProbReplaced;
-};
-static EdgeReplacingPerturber kerp;
+}
 
 int
 main(int argc, char** argv)
 {
-  std::string model, type, params;
+  std::string model, outDir, ensemble;
+  std::vector<std::string> typeArgs, paramArgs;
+  uint32_t replicates, threads;
+  uint64_t seed;
 
   po::options_description desc;
 
   desc.add_options()
-    ("model", po::value<std::string>(&model), "TF net model to perturb")
-    ("type", po::value<std::string>(&type), "Type of perturber to use. --type=help to list")
-    ("params", po::value<std::string>(&params), "Parameters for the perturber (type dependent)")
+    ("model", po::value<std::string>(&model), "TF net model to perturb (text or binary)")
+    ("type", po::value<std::vector<std::string> >(&typeArgs)->composing(),
+     "Type of perturber to use, or a comma separated list of types to apply "
+     "one after another. --type=help to list")
+    ("params", po::value<std::vector<std::string> >(&paramArgs)->composing(),
+     "Parameters for the perturber (type dependent); with several types, a "
+     "comma separated list with one entry per type, where an empty entry "
+     "keeps that type's defaults. An entry may list several values "
+     "separated by colons, to generate replicates for each of them (and for "
+     "every combination, across steps)")
+    ("replicates", po::value<uint32_t>(&replicates)->default_value(1),
+     "Number of perturbed networks to generate for each set of parameters")
+    ("seed", po::value<uint64_t>(&seed), "Seed the replicates' random "
+     "numbers are derived from, to make a run reproducible (by default, one "
+     "is made from the clock and the process ID)")
+    ("threads", po::value<uint32_t>(&threads)->default_value(1), "Number of "
+     "replicates to generate in parallel")
+    ("out-dir", po::value<std::string>(&outDir), "Directory to write each "
+     "replicate to, named after its parameters and number, instead of "
+     "standard output; needed for more than one")
+    ("ensemble", po::value<std::string>(&ensemble), "Instead of writing out "
+     "the replicates, summarise them in this file: degree distributions, "
+     "edge overlap with the model, reciprocity and per-vertex degree "
+     "z-scores, for each set of parameters")
     ("help", "produce help message")
     ;
 
@@ -580,23 +296,115 @@ main(int argc, char** argv)
     return 1;
   }
 
-  if (type == "help")
+  std::vector<std::string> types, params;
+  splitList(typeArgs, ",", types);
+  splitList(paramArgs, ",", params);
+
+  if (types.size() == 1 && types[0] == "help")
   {
     ModelPerturber::listAvailablePerturbers(std::cout);
     return 1;
   }
 
-  ModelPerturber* mp = ModelPerturber::findPerturberByName(type);
-  if (mp == NULL)
+  std::vector<ModelPerturber*> steps;
+  for (uint32_t i = 0; i < types.size(); i++)
+  {
+    ModelPerturber* mp = ModelPerturber::findPerturberByName(types[i]);
+    if (mp == NULL)
+    {
+      std::cerr << "Invalid model perturber type requested: " << types[i]
+                << std::endl;
+      return 1;
+    }
+    steps.push_back(mp);
+  }
+
+  if (!params.empty() && params.size() != steps.size())
+  {
+    std::cerr << "Give one --params entry per perturber type." << std::endl;
+    return 1;
+  }
+  params.resize(steps.size());
+
+  // Every combination of the values given for each step, the last step's
+  // varying fastest.
+  std::vector<std::vector<std::string> > combinations(1);
+  for (uint32_t i = 0; i < steps.size(); i++)
   {
-    std::cerr << "Invalid model perturber type requested."
+    std::vector<std::string> values;
+    splitList(std::vector<std::string>(1, params[i]), ":", values);
+
+    std::vector<std::vector<std::string> > extended;
+    for (uint32_t c = 0; c < combinations.size(); c++)
+      for (uint32_t v = 0; v < values.size(); v++)
+      {
+        extended.push_back(combinations[c]);
+        extended.back().push_back(values[v]);
+      }
+    combinations.swap(extended);
+  }
+
+  if (replicates == 0)
+  {
+    std::cerr << "--replicates must be at least 1." << std::endl;
+    return 1;
+  }
+  if (ensemble != "" && outDir != "")
+  {
+    std::cerr << "--ensemble writes no replicates, so takes no --out-dir."
               << std::endl;
     return 1;
   }
+  if ((replicates > 1 || combinations.size() > 1) && outDir == "" &&
+      ensemble == "")
+  {
+    std::cerr << "More than one replicate or set of parameters needs "
+              << "--out-dir." << std::endl;
+    return 1;
+  }
 
-  if (vm.count("params"))
-    mp->setParams(params);
-  mp->perturb(model);
+  if (!vm.count("seed"))
+    seed = (static_cast<uint64_t>(time(0)) << 32) ^ getpid();
+
+  NetworkModel network;
+  if (!network.load(model, std::cerr))
+    return 1;
+
+  ReplicateGenerator generator(network, steps, combinations, replicates,
+                               seed, outDir);
+  if (ensemble != "")
+  {
+    EnsembleReference reference(network);
+    std::vector<EnsembleStatistics> statistics(combinations.size());
+    generator.summarise(reference, statistics);
+    bool ok = generator.run(threads);
+
+    std::ofstream out(ensemble.c_str(), std::ios::binary);
+    for (uint32_t c = 0; c < combinations.size(); c++)
+      statistics[c].write(out, reference, generator.label(combinations[c]));
+    if (!out.good())
+    {
+      std::cerr << "Could not write " << ensemble << std::endl;
+      return 1;
+    }
+    return ok ? 0 : 1;
+  }
+
+  if (outDir == "")
+  {
+    NetworkModel networks[2];
+    std::string error;
+    const NetworkModel* perturbed =
+      generator.generate(steps, combinations[0], 0, networks, error);
+    if (perturbed == NULL)
+    {
+      std::cerr << error << std::endl;
+      return 1;
+    }
+    perturbed->writeText(std::cout);
+    return 0;
+  }
 
-  return 0;
+  fs::create_directories(outDir);
+  return generator.run(threads) ? 0 : 1;
 }
@@ -0,0 +1,706 @@
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/random.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind/bind.hpp>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <stdint.h>
+
+namespace po = boost::program_options;
+namespace fs = boost::filesystem;
+
+// Writes text to a file through a large buffer, with the few kinds of
+// number the inputs need formatted by hand, so that generating tens of
+// gigabytes is limited by the disk rather than by iostreams.
+class SynthWriter
+{
+public:
+  SynthWriter(const std::string& aPath)
+    : mPath(aPath), mOut(aPath.c_str(), std::ios::binary), mWritten(0)
+  {
+    mBuffer.reserve(kBufferSize + 4096);
+  }
+
+  SynthWriter&
+  operator<<(const char* aText)
+  {
+    mBuffer.append(aText);
+    return *this;
+  }
+
+  SynthWriter&
+  operator<<(const std::string& aText)
+  {
+    mBuffer.append(aText);
+    return *this;
+  }
+
+  SynthWriter&
+  operator<<(char aChar)
+  {
+    mBuffer += aChar;
+    return *this;
+  }
+
+  SynthWriter&
+  operator<<(uint32_t aValue)
+  {
+    char digits[10];
+    int n = 0;
+    do
+    {
+      digits[n++] = '0' + aValue % 10;
+      aValue /= 10;
+    }
+    while (aValue != 0);
+    while (n > 0)
+      mBuffer += digits[--n];
+    return *this;
+  }
+
+  // aValue right aligned in a field of aWidth characters.
+  void
+  padded(uint32_t aValue, uint32_t aWidth, char aFill)
+  {
+    char digits[10];
+    uint32_t n = 0;
+    do
+    {
+      digits[n++] = '0' + aValue % 10;
+      aValue /= 10;
+    }
+    while (aValue != 0);
+    for (; aWidth > n; aWidth--)
+      mBuffer += aFill;
+    while (n > 0)
+      mBuffer += digits[--n];
+  }
+
+  // Ends a line, and writes the buffer out once it is full.
+  void
+  endl()
+  {
+    mBuffer += '\n';
+    if (mBuffer.size() >= kBufferSize)
+      flush();
+  }
+
+  // Writes out the rest, and returns false if anything failed to write.
+  bool
+  close()
+  {
+    flush();
+    mOut.close();
+    if (mOut.fail())
+    {
+      std::cerr << "Could not write " << mPath << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  uint64_t
+  written() const
+  {
+    return mWritten + mBuffer.size();
+  }
+
+private:
+  static const size_t kBufferSize = 1 << 20;
+
+  void
+  flush()
+  {
+    mOut.write(mBuffer.data(), mBuffer.size());
+    mWritten += mBuffer.size();
+    mBuffer.clear();
+  }
+
+  std::string mPath;
+  std::ofstream mOut;
+  std::string mBuffer;
+  uint64_t mWritten;
+};
+
+// Everything about the data set to generate.
+struct SynthConfig
+{
+  std::string outDir;
+  uint32_t seed, chromosomes, contigs, contigLength, genes, hgncGenes;
+  uint32_t aliases, matrices, threads;
+  double tfbsDensity;
+  bool sequence;
+};
+
+// Generates a consistent set of builder inputs: an HGNC names TSV of
+// hgncGenes genes with their previous symbols and aliases; a TRANSFAC
+// matrix.dat whose factors name those genes in the various ways the
+// builder's name resolution deals with; and for each chromosome, a GenBank
+// file of contigs with gene features cross-referenced to HGNC IDs, and a
+// BaSeTraM output file per contig of TFBSs for the matrices. Each file has
+// its own random number stream, so the output depends only on the
+// configuration and the seed, whatever the number of threads.
+class SynthGenerator
+{
+public:
+  SynthGenerator(const SynthConfig& aConfig)
+    : mConfig(aConfig), mNextChromosome(0), mFailed(false), mHGNCBytes(0),
+      mMatrixBytes(0), mGenBankBytes(0), mBaSeTraMBytes(0)
+  {
+    static const char* kFamilies[] =
+    {
+      "FOX", "SOX", "PAX", "ZNF", "GATA", "HOX", "NFK", "STAT", "IRF", "KLF",
+      "TBX", "MYO"
+    };
+    static const uint32_t kFamilyCount = sizeof(kFamilies) / sizeof(*kFamilies);
+
+    // Symbols are made unique by numbering each family in turn.
+    for (uint32_t i = 0; i < mConfig.hgncGenes; i++)
+    {
+      std::string symbol(kFamilies[i % kFamilyCount]);
+      appendNumber(symbol, i / kFamilyCount + 1);
+      mSymbols.push_back(symbol);
+    }
+  }
+
+  bool
+  generate()
+  {
+    fs::path root(mConfig.outDir);
+    boost::system::error_code ec;
+    fs::create_directories(root / "genbank", ec);
+    if (!ec)
+      fs::create_directories(root / "basetram", ec);
+    if (ec)
+    {
+      std::cerr << "Could not create " << mConfig.outDir << ": "
+                << ec.message() << std::endl;
+      return false;
+    }
+
+    bool ok = writeHGNC((root / "hgnc.txt").string());
+    ok = writeMatrices((root / "matrix.dat").string()) && ok;
+
+    uint32_t threads = std::min(std::max(mConfig.threads, 1U),
+                                std::max(mConfig.chromosomes, 1U));
+    if (threads == 1)
+      work();
+    else
+    {
+      boost::thread_group workers;
+      for (uint32_t i = 0; i < threads; i++)
+        workers.create_thread(boost::bind(&SynthGenerator::work, this));
+      workers.join_all();
+    }
+
+    std::cout << "hgnc.txt: " << mHGNCBytes << " bytes" << std::endl
+              << "matrix.dat: " << mMatrixBytes << " bytes" << std::endl
+              << "genbank: " << mGenBankBytes << " bytes" << std::endl
+              << "basetram: " << mBaSeTraMBytes << " bytes" << std::endl;
+    return ok && !mFailed;
+  }
+
+private:
+  // The streams are numbered: 0 for the HGNC file, 1 for the matrices, and
+  // 2 + n for chromosome n.
+  void
+  seedStream(boost::mt19937& aRng, uint32_t aStream) const
+  {
+    uint64_t z = (static_cast<uint64_t>(mConfig.seed) << 32 | aStream) +
+      0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    aRng.seed(static_cast<uint32_t>((z ^ (z >> 31)) >> 32));
+  }
+
+  static void
+  appendNumber(std::string& aText, uint32_t aValue)
+  {
+    char digits[10];
+    int n = 0;
+    do
+    {
+      digits[n++] = '0' + aValue % 10;
+      aValue /= 10;
+    }
+    while (aValue != 0);
+    while (n > 0)
+      aText += digits[--n];
+  }
+
+  static std::string
+  lower(const std::string& aText)
+  {
+    std::string l(aText);
+    for (uint32_t i = 0; i < l.size(); i++)
+      if (l[i] >= 'A' && l[i] <= 'Z')
+        l[i] = l[i] - 'A' + 'a';
+    return l;
+  }
+
+  std::string
+  previousSymbol(uint32_t aGene) const
+  {
+    return mSymbols[aGene] + "L";
+  }
+
+  std::string
+  alias(uint32_t aGene, uint32_t aIndex) const
+  {
+    std::string a(lower(mSymbols[aGene]) + "-as");
+    appendNumber(a, aIndex + 1);
+    return a;
+  }
+
+  // One in twenty genes is withdrawn, and none of its names count.
+  static bool
+  isWithdrawn(uint32_t aGene)
+  {
+    return aGene % 20 == 19;
+  }
+
+  bool
+  writeHGNC(const std::string& aPath)
+  {
+    boost::mt19937 rng;
+    seedStream(rng, 0);
+    boost::uniform_int<uint32_t> coin(0, 1);
+
+    SynthWriter out(aPath);
+    out << "HGNC ID\tApproved Symbol\tApproved Name\tStatus\t"
+        << "Previous Symbols\tAliases";
+    out.endl();
+    for (uint32_t g = 0; g < mConfig.hgncGenes; g++)
+    {
+      out << (g + 1) << '\t' << mSymbols[g] << '\t' << lower(mSymbols[g])
+          << " transcription factor\t"
+          << (isWithdrawn(g) ? "Entry Withdrawn" : "Approved") << '\t';
+      if (coin(rng))
+        out << previousSymbol(g);
+      out << '\t';
+      for (uint32_t a = 0; a < mConfig.aliases; a++)
+        out << (a == 0 ? "" : ", ") << alias(g, a);
+      out.endl();
+    }
+
+    mHGNCBytes = out.written();
+    return out.close();
+  }
+
+  // A name for a gene, as a matrix's factor might be given: its symbol, in
+  // lower case, with a dash and number after it, by a previous symbol or an
+  // alias, or (now and then) a name nothing resolves.
+  std::string
+  factorName(uint32_t aGene, boost::mt19937& aRng) const
+  {
+    boost::uniform_int<uint32_t> form(0, 9);
+    switch (form(aRng))
+    {
+    case 0:
+    case 1:
+    case 2:
+      return mSymbols[aGene];
+    case 3:
+      return lower(mSymbols[aGene]);
+    case 4:
+      return mSymbols[aGene] + "-1";
+    case 5:
+      return previousSymbol(aGene);
+    case 6:
+    case 7:
+      if (mConfig.aliases != 0)
+        return alias(aGene, 0);
+      return mSymbols[aGene];
+    case 8:
+      return mSymbols[aGene] + "alpha";
+    default:
+      {
+        std::string unknown("UNKNOWN");
+        appendNumber(unknown, aGene + 1);
+        return unknown;
+      }
+    }
+  }
+
+  bool
+  writeMatrices(const std::string& aPath)
+  {
+    boost::mt19937 rng;
+    seedStream(rng, 1);
+    boost::uniform_int<uint32_t> gene(0, mConfig.hgncGenes - 1);
+    boost::uniform_int<uint32_t> factors(0, 3), width(8, 20), count(0, 30);
+
+    SynthWriter out(aPath);
+    out << "VV  TRANSFAC MATRIX TABLE, synthetic";
+    out.endl();
+    out << "XX";
+    out.endl();
+    out << "//";
+    out.endl();
+    for (uint32_t m = 0; m < mConfig.matrices; m++)
+    {
+      std::string accession(matrixAccession(m));
+      std::string name(mConfig.hgncGenes ? factorName(gene(rng), rng) : "X");
+
+      out << "AC  " << accession;
+      out.endl();
+      out << "XX";
+      out.endl();
+      out << "ID  V$" << name << "_01";
+      out.endl();
+      out << "XX";
+      out.endl();
+      out << "NA  " << name << " binding site";
+      out.endl();
+      out << "XX";
+      out.endl();
+
+      uint32_t n = mConfig.hgncGenes ? factors(rng) : 0;
+      for (uint32_t f = 0; f < n; f++)
+      {
+        out << "BF  T";
+        out.padded(m * 4 + f + 1, 5, '0');
+        out << ' ' << factorName(gene(rng), rng)
+            << "; Species: human, Homo sapiens.";
+        out.endl();
+      }
+      if (n != 0)
+      {
+        out << "XX";
+        out.endl();
+      }
+
+      out << "P0      A      C      G      T";
+      out.endl();
+      uint32_t w = width(rng);
+      for (uint32_t p = 0; p < w; p++)
+      {
+        out.padded(p + 1, 2, '0');
+        for (uint32_t b = 0; b < 4; b++)
+          out.padded(count(rng), 7, ' ');
+        out << "      N";
+        out.endl();
+      }
+      out << "XX";
+      out.endl();
+      out << "//";
+      out.endl();
+    }
+
+    mMatrixBytes = out.written();
+    return out.close();
+  }
+
+  static std::string
+  matrixAccession(uint32_t aMatrix)
+  {
+    std::string a("M");
+    std::string n;
+    appendNumber(n, aMatrix + 1);
+    if (n.size() < 5)
+      a.append(5 - n.size(), '0');
+    return a + n;
+  }
+
+  void
+  work()
+  {
+    while (true)
+    {
+      uint32_t c;
+      {
+        boost::mutex::scoped_lock lock(mMutex);
+        c = mNextChromosome++;
+      }
+      if (c >= mConfig.chromosomes)
+        break;
+
+      uint64_t genBankBytes = 0, baSeTraMBytes = 0;
+      bool ok = writeChromosome(c, genBankBytes, baSeTraMBytes);
+
+      boost::mutex::scoped_lock lock(mMutex);
+      mGenBankBytes += genBankBytes;
+      mBaSeTraMBytes += baSeTraMBytes;
+      if (!ok)
+        mFailed = true;
+    }
+  }
+
+  struct SynthGene
+  {
+    uint32_t start, end, hgncId;
+    bool complement;
+
+    bool
+    operator<(const SynthGene& aOther) const
+    {
+      return start < aOther.start;
+    }
+  };
+
+  bool
+  writeChromosome(uint32_t aChromosome, uint64_t& aGenBankBytes,
+                  uint64_t& aBaSeTraMBytes)
+  {
+    boost::mt19937 rng;
+    seedStream(rng, 2 + aChromosome);
+
+    std::string name("chr");
+    appendNumber(name, aChromosome + 1);
+    fs::path root(mConfig.outDir);
+    fs::path siteDir(root / "basetram" / name);
+    boost::system::error_code ec;
+    fs::create_directories(siteDir, ec);
+    if (ec)
+    {
+      std::cerr << "Could not create " << siteDir.string() << ": "
+                << ec.message() << std::endl;
+      return false;
+    }
+
+    bool ok = true;
+    SynthWriter genBank((root / "genbank" / (name + ".gbk")).string());
+    for (uint32_t c = 0; c < mConfig.contigs; c++)
+    {
+      std::string locus("NT_");
+      std::string number;
+      appendNumber(number, aChromosome * mConfig.contigs + c + 1);
+      locus.append(6 - std::min<size_t>(6, number.size()), '0');
+      locus += number;
+
+      writeContig(genBank, locus, rng);
+
+      SynthWriter sites((siteDir / locus).string());
+      writeSites(sites, locus, rng);
+      aBaSeTraMBytes += sites.written();
+      ok = sites.close() && ok;
+    }
+    aGenBankBytes += genBank.written();
+    return genBank.close() && ok;
+  }
+
+  void
+  writeContig(SynthWriter& aOut, const std::string& aLocus,
+              boost::mt19937& aRng)
+  {
+    uint32_t length = mConfig.contigLength;
+    std::vector<SynthGene> genes;
+    if (mConfig.hgncGenes != 0 && length > 2)
+    {
+      boost::uniform_int<uint32_t> start(1, length - 1), span(200, 50000);
+      boost::uniform_int<uint32_t> id(0, mConfig.hgncGenes - 1), coin(0, 1);
+      for (uint32_t g = 0; g < mConfig.genes; g++)
+      {
+        SynthGene gene;
+        gene.start = start(aRng);
+        gene.end = std::min(length, gene.start + span(aRng));
+        uint32_t i = id(aRng);
+        // Annotations only refer to approved genes.
+        if (isWithdrawn(i))
+          i--;
+        gene.hgncId = i + 1;
+        gene.complement = coin(aRng) != 0;
+        genes.push_back(gene);
+      }
+      std::sort(genes.begin(), genes.end());
+    }
+
+    aOut << "LOCUS       " << aLocus << ' ';
+    aOut.padded(length, 12, ' ');
+    aOut << " bp    DNA     linear   CON 01-JAN-2009";
+    aOut.endl();
+    aOut << "DEFINITION  Homo sapiens chromosome genomic contig, synthetic.";
+    aOut.endl();
+    aOut << "ACCESSION   " << aLocus;
+    aOut.endl();
+    aOut << "FEATURES             Location/Qualifiers";
+    aOut.endl();
+    aOut << "     source          1.." << length;
+    aOut.endl();
+    aOut << "                     /organism=\"Homo sapiens\"";
+    aOut.endl();
+    aOut << "                     /mol_type=\"genomic DNA\"";
+    aOut.endl();
+
+    // Each gene has an mRNA and a CDS after it, which the builder skips.
+    static const char* kFeatures[] = { "gene", "mRNA", "CDS" };
+    for (uint32_t g = 0; g < genes.size(); g++)
+    {
+      for (uint32_t f = 0; f < 3; f++)
+      {
+        aOut << "     " << kFeatures[f];
+        for (size_t pad = strlen(kFeatures[f]); pad < 16; pad++)
+          aOut << ' ';
+        if (genes[g].complement)
+          aOut << "complement(" << genes[g].start << ".." << genes[g].end
+               << ')';
+        else
+          aOut << genes[g].start << ".." << genes[g].end;
+        aOut.endl();
+        aOut << "                     /gene=\"" << mSymbols[genes[g].hgncId - 1]
+             << '"';
+        aOut.endl();
+        aOut << "                     /db_xref=\"GeneID:" << genes[g].hgncId
+             << '"';
+        aOut.endl();
+        if (f == 0)
+        {
+          aOut << "                     /db_xref=\"HGNC:" << genes[g].hgncId
+               << '"';
+          aOut.endl();
+        }
+      }
+    }
+
+    aOut << "ORIGIN";
+    aOut.endl();
+    if (mConfig.sequence)
+      writeSequence(aOut, length, aRng);
+    aOut << "//";
+    aOut.endl();
+  }
+
+  // GenBank sequence lines: the position, then up to six blocks of ten bases.
+  static void
+  writeSequence(SynthWriter& aOut, uint32_t aLength, boost::mt19937& aRng)
+  {
+    static const char kBases[] = "acgt";
+    uint32_t bits = 0, left = 0;
+    for (uint32_t line = 0; line < aLength; line += 60)
+    {
+      aOut.padded(line + 1, 9, ' ');
+      for (uint32_t i = line; i < aLength && i < line + 60; i++)
+      {
+        if ((i - line) % 10 == 0)
+          aOut << ' ';
+        if (left == 0)
+        {
+          bits = aRng();
+          left = 16;
+        }
+        aOut << kBases[bits & 3];
+        bits >>= 2;
+        left--;
+      }
+      aOut.endl();
+    }
+  }
+
+  // TFBSs in position order, tfbsDensity per kilobase on average.
+  void
+  writeSites(SynthWriter& aOut, const std::string& aLocus, boost::mt19937& aRng)
+  {
+    aOut << "LOCUS       " << aLocus;
+    aOut.endl();
+    aOut << "FEATURES             Location/Qualifiers";
+    aOut.endl();
+
+    if (mConfig.matrices != 0 && mConfig.tfbsDensity > 0)
+    {
+      uint32_t meanGap = static_cast<uint32_t>(1000 / mConfig.tfbsDensity);
+      boost::uniform_int<uint32_t> gap(0, 2 * std::max(meanGap, 1U) - 1);
+      boost::uniform_int<uint32_t> width(8, 20), matrix(0, mConfig.matrices - 1);
+      boost::uniform_int<uint32_t> probability(0, 9999), coin(0, 1);
+
+      uint64_t position = 1;
+      while (true)
+      {
+        position += gap(aRng);
+        uint32_t w = width(aRng);
+        if (position + w - 1 > mConfig.contigLength)
+          break;
+
+        uint32_t start = position, end = position + w - 1;
+        aOut << "     TFBS            ";
+        if (coin(aRng))
+          aOut << "complement(" << start << ".." << end << ')';
+        else
+          aOut << start << ".." << end;
+        aOut.endl();
+        aOut << "                     /probability=0.";
+        aOut.padded(probability(aRng), 4, '0');
+        aOut.endl();
+        aOut << "                     /db_xref=\"TRANSFAC:"
+             << matrixAccession(matrix(aRng)) << '"';
+        aOut.endl();
+      }
+    }
+
+    aOut << "//";
+    aOut.endl();
+  }
+
+  SynthConfig mConfig;
+  std::vector<std::string> mSymbols;
+
+  boost::mutex mMutex;
+  uint32_t mNextChromosome;
+  bool mFailed;
+  uint64_t mHGNCBytes, mMatrixBytes, mGenBankBytes, mBaSeTraMBytes;
+};
+
+int
+main(int argc, char** argv)
+{
+  SynthConfig config;
+
+  po::options_description desc;
+
+  desc.add_options()
+    ("out-dir", po::value<std::string>(&config.outDir), "Directory to write "
+     "the data set to: genbank/ and basetram/ directories, hgnc.txt and "
+     "matrix.dat, to pass to tfnetbuilder")
+    ("seed", po::value<uint32_t>(&config.seed)->default_value(1), "Random "
+     "seed; the same seed and sizes give the same files")
+    ("chromosomes", po::value<uint32_t>(&config.chromosomes)->default_value(4),
+     "Number of chromosomes (GenBank files)")
+    ("contigs", po::value<uint32_t>(&config.contigs)->default_value(2),
+     "Number of contigs in each chromosome")
+    ("contig-length",
+     po::value<uint32_t>(&config.contigLength)->default_value(1000000),
+     "Length of each contig, in bases")
+    ("genes", po::value<uint32_t>(&config.genes)->default_value(200),
+     "Number of genes on each contig")
+    ("tfbs-density", po::value<double>(&config.tfbsDensity)->default_value(10),
+     "Mean number of TFBSs per kilobase of contig")
+    ("hgnc-genes", po::value<uint32_t>(&config.hgncGenes)->default_value(20000),
+     "Number of genes in the HGNC names file")
+    ("aliases", po::value<uint32_t>(&config.aliases)->default_value(2),
+     "Number of aliases for each HGNC gene")
+    ("matrices", po::value<uint32_t>(&config.matrices)->default_value(500),
+     "Number of TRANSFAC matrices")
+    ("no-sequence", "Leave the sequence out of the GenBank files (it is "
+     "about half their size, and the builder does not use it)")
+    ("threads", po::value<uint32_t>(&config.threads)->default_value(1),
+     "Number of chromosomes to write in parallel")
+    ("help", "produce help message")
+    ;
+
+  po::variables_map vm;
+
+  po::store(po::parse_command_line(argc, argv, desc), vm);
+  po::notify(vm);
+
+  std::string wrong;
+  if (!vm.count("help") && !vm.count("out-dir"))
+    wrong = "out-dir";
+
+  if (wrong != "")
+    std::cerr << "Missing option: " << wrong << std::endl;
+
+  if (vm.count("help") || wrong != "")
+  {
+    std::cerr << desc << std::endl;
+    return 1;
+  }
+
+  config.sequence = !vm.count("no-sequence");
+
+  SynthGenerator generator(config);
+  return generator.generate() ? 0 : 1;
+}
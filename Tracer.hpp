@@ -0,0 +1,203 @@
+#ifndef TFNET_TRACER_HPP
+#define TFNET_TRACER_HPP
+
+#include <boost/thread.hpp>
+#include <fstream>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <time.h>
+
+// Records how long each stage of a run takes, for writing out in the Chrome
+// trace event format (which chrome://tracing and Perfetto load), with a
+// track for each thread. Stages are timed by TraceScopes, which do nothing
+// but test a pointer unless a Tracer has been made active.
+class Tracer
+{
+public:
+  Tracer()
+    : mOrigin(now())
+  {
+  }
+
+  // The Tracer the TraceScopes record into, or NULL. It is set before any
+  // other thread starts, and only read after that.
+  static Tracer*&
+  active()
+  {
+    static Tracer* sActive = NULL;
+    return sActive;
+  }
+
+  // Names the calling thread's track.
+  void
+  nameThread(const std::string& aName)
+  {
+    boost::mutex::scoped_lock lock(mMutex);
+    mThreadNames[threadIndex()] = aName;
+  }
+
+  // Adds a stage that started at aStart, as given by now(), and ends now.
+  // aDetail, if not empty, is shown with it (a file or contig name, say).
+  void
+  record(const char* aName, double aStart, const std::string& aDetail)
+  {
+    double end = now();
+    boost::mutex::scoped_lock lock(mMutex);
+    Event event;
+    event.name = aName;
+    event.detail = aDetail;
+    event.thread = threadIndex();
+    event.start = (aStart - mOrigin) * 1E6;
+    event.duration = (end - aStart) * 1E6;
+    mEvents.push_back(event);
+  }
+
+  bool
+  write(const std::string& aPath, std::string& aError)
+  {
+    std::ofstream out(aPath.c_str());
+    if (!out)
+    {
+      aError = "Cannot write " + aPath;
+      return false;
+    }
+
+    boost::mutex::scoped_lock lock(mMutex);
+    out.setf(std::ios::fixed);
+    out.precision(3);
+    out << "{\"traceEvents\": [" << std::endl;
+    bool first = true;
+    for
+    (
+     std::map<uint32_t, std::string>::const_iterator i = mThreadNames.begin();
+     i != mThreadNames.end();
+     i++
+    )
+    {
+      out << (first ? "" : ",\n")
+          << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, "
+          << "\"tid\": " << (*i).first << ", \"args\": {\"name\": ";
+      writeString(out, (*i).second);
+      out << "}}";
+      first = false;
+    }
+    for (size_t i = 0; i < mEvents.size(); i++)
+    {
+      const Event& e(mEvents[i]);
+      out << (first ? "" : ",\n") << "{\"name\": ";
+      writeString(out, e.name);
+      out << ", \"cat\": \"tfnet\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+          << e.thread << ", \"ts\": " << e.start << ", \"dur\": "
+          << e.duration;
+      if (e.detail != "")
+      {
+        out << ", \"args\": {\"detail\": ";
+        writeString(out, e.detail);
+        out << "}";
+      }
+      out << "}";
+      first = false;
+    }
+    out << std::endl << "], \"displayTimeUnit\": \"ms\"}" << std::endl;
+
+    if (!out)
+    {
+      aError = "Cannot write " + aPath;
+      return false;
+    }
+    return true;
+  }
+
+  static double
+  now()
+  {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1E-9;
+  }
+
+private:
+  struct Event
+  {
+    std::string name, detail;
+    uint32_t thread;
+    double start, duration;
+  };
+
+  // Threads are numbered in the order they first record something. Called
+  // with mMutex held.
+  uint32_t
+  threadIndex()
+  {
+    std::map<boost::thread::id, uint32_t>::iterator i =
+      mThreads.find(boost::this_thread::get_id());
+    if (i != mThreads.end())
+      return (*i).second;
+    uint32_t index = mThreads.size();
+    mThreads[boost::this_thread::get_id()] = index;
+    return index;
+  }
+
+  static void
+  writeString(std::ostream& aOut, const std::string& aString)
+  {
+    static const char kHex[] = "0123456789abcdef";
+    aOut << '"';
+    for (size_t i = 0; i < aString.size(); i++)
+    {
+      unsigned char c = aString[i];
+      if (c == '"' || c == '\\')
+        aOut << '\\' << c;
+      else if (c < 0x20)
+        aOut << "\\u00" << kHex[c >> 4] << kHex[c & 15];
+      else
+        aOut << c;
+    }
+    aOut << '"';
+  }
+
+  double mOrigin;
+  boost::mutex mMutex;
+  std::vector<Event> mEvents;
+  std::map<boost::thread::id, uint32_t> mThreads;
+  std::map<uint32_t, std::string> mThreadNames;
+};
+
+// Times the stage from its construction to the end of its scope, if a
+// Tracer is active. The detail is only copied when one is.
+class TraceScope
+{
+public:
+  TraceScope(const char* aName)
+    : mTracer(Tracer::active()), mName(aName), mStart(0.0)
+  {
+    if (mTracer)
+      mStart = Tracer::now();
+  }
+
+  TraceScope(const char* aName, const std::string& aDetail)
+    : mTracer(Tracer::active()), mName(aName), mStart(0.0)
+  {
+    if (mTracer)
+    {
+      mDetail = aDetail;
+      mStart = Tracer::now();
+    }
+  }
+
+  ~TraceScope()
+  {
+    if (mTracer)
+      mTracer->record(mName, mStart, mDetail);
+  }
+
+private:
+  Tracer* mTracer;
+  const char* mName;
+  std::string mDetail;
+  double mStart;
+};
+
+#endif // TFNET_TRACER_HPP